@@ -0,0 +1,292 @@
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <random>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+#include "hashbenchmark.h"
+#include "hashmapped.h"
+#include "hashruntime.h"
+#include "testmaps.h"
+
+//Lookup benchmark: every map over the same query streams, next to std::unordered_map, a sorted array and a
+//switch. The generated maps are those HashSearch writes, and are left out until it has been run.
+#if __has_include("poifect_adhocsymbols_switch.h")
+#include "poifect_cppkeywords.h"
+#include "poifect_cppkeywords2.h"
+#include "poifect_cppkeywords2minimal.h"
+#include "poifect_cppkeywords2partitioned.h"
+#include "poifect_cppkeywords_switch.h"
+#include "poifect_greekletters.h"
+#include "poifect_greekletters2.h"
+#include "poifect_greekletters_switch.h"
+#include "poifect_adhocsymbols.h"
+#include "poifect_adhocsymbols2.h"
+#include "poifect_adhocsymbols_switch.h"
+#define POIFECT_GENERATED_MAPS
+#endif
+
+static const char* usage =
+    "Usage: PoifectBenchmark [options]\n"
+    "Times lookups in every map over uniform and Zipf query streams with 100%, 50% and 0% hits.\n"
+    "\n"
+    "  -q, --queries N      queries per stream (default 1000000)\n"
+    "  -r, --repetitions N  timed passes per stream, the median is reported (default 5)\n"
+    "  -k, --random-keys N  size of the random string key set, 0 to skip it (default 100000)\n"
+    "  -s, --seed N         seed of the key set and query generators (default 1)\n"
+    "      --json PATH      also write the results as JSON\n";
+
+struct BenchmarkOptions{
+    size_t queries = 1000000;
+    size_t repetitions = 5;
+    size_t random_keys = 100000;
+    uint64_t seed = 1;
+    std::string json_path;
+};
+
+static bool parseArgs(int argc, char** argv, BenchmarkOptions& options){
+    for(int i = 1; i < argc; i++){
+        const std::string arg = argv[i];
+        auto number = [&](size_t min, uint64_t& val){
+            if(i+1 == argc){
+                std::fprintf(stderr, "%s requires a value\n", arg.c_str());
+                return false;
+            }
+            const char* str = argv[++i];
+            char* end;
+            val = std::strtoull(str, &end, 10);
+            if(*str == '\0' || *str == '-' || *end != '\0' || val < min){
+                std::fprintf(stderr, "%s must be a whole number of at least %zu\n", arg.c_str(), min);
+                return false;
+            }
+            return true;
+        };
+        uint64_t val;
+
+        if(arg == "-h" || arg == "--help"){
+            std::fputs(usage, stdout);
+            std::exit(EXIT_SUCCESS);
+        }else if(arg == "-q" || arg == "--queries"){
+            if(!number(sample_size, val)) return false;
+            options.queries = size_t(val);
+        }else if(arg == "-r" || arg == "--repetitions"){
+            if(!number(1, val)) return false;
+            options.repetitions = size_t(val);
+        }else if(arg == "-k" || arg == "--random-keys"){
+            if(!number(0, val)) return false;
+            options.random_keys = size_t(val);
+        }else if(arg == "-s" || arg == "--seed"){
+            if(!number(0, options.seed)) return false;
+        }else if(arg == "--json"){
+            if(i+1 == argc){
+                std::fputs("--json requires a value\n", stderr);
+                return false;
+            }
+            options.json_path = argv[++i];
+        }else{
+            std::fprintf(stderr, "unknown option %s\n%s", arg.c_str(), usage);
+            return false;
+        }
+    }
+
+    if(options.random_keys == 1){
+        std::fputs("random key set requires at least 2 keys\n", stderr);
+        return false;
+    }
+
+    return true;
+}
+
+static const QueryStream streams[] = {
+    {QueryDistribution::uniform, 1.0},
+    {QueryDistribution::uniform, 0.5},
+    {QueryDistribution::uniform, 0.0},
+    {QueryDistribution::zipf, 1.0},
+    {QueryDistribution::zipf, 0.5},
+    {QueryDistribution::zipf, 0.0},
+};
+
+//One key set's query streams, built once so every map is timed on the same queries
+template<typename KeyType>
+class KeySetBenchmark{
+public:
+    typedef typename std::conditional<std::is_same<KeyType, std::string>::value, std::string_view, KeyType>::type Query;
+
+    KeySetBenchmark(const std::string& key_set, const std::vector<KeyType>& keys, const BenchmarkOptions& options, std::vector<BenchmarkResult>& results)
+        : key_set(key_set), num_keys(keys.size()), repetitions(options.repetitions), results(results){
+        std::mt19937_64 rng(options.seed);
+        misses = makeMisses(keys, std::max<size_t>(keys.size(), 1000), rng);
+
+        const std::vector<Query> hit_queries(keys.begin(), keys.end());
+        const std::vector<Query> miss_queries(misses.begin(), misses.end());
+        for(const QueryStream& stream : streams)
+            queries.push_back(makeQueries(hit_queries, miss_queries, options.queries, stream, rng));
+    }
+
+    template<typename Lookup>
+    void run(const std::string& map, const Lookup& lookup){
+        for(size_t i = 0; i < queries.size(); i++){
+            BenchmarkResult result = benchmarkLookups(queries[i], lookup, repetitions);
+            result.key_set = key_set;
+            result.map = map;
+            result.stream = streams[i].name();
+            result.hit_ratio = streams[i].hit_ratio;
+            result.num_keys = num_keys;
+
+            std::printf("%-10s %-24s %-16s %9.2f %9.2f %9.2f %9.2f %9.2f %9.2f\n",
+                        key_set.c_str(), map.c_str(), result.stream.c_str(), result.mean_ns,
+                        result.p50_ns, result.p90_ns, result.p99_ns, result.p999_ns, result.max_ns);
+            std::fflush(stdout);
+            results.push_back(std::move(result));
+        }
+    }
+
+    void runBaselines(const std::vector<KeyType>& keys, const std::vector<std::string>& vals, std::string_view default_value){
+        const UnorderedMapBaseline<KeyType> unordered_map(keys, vals, default_value);
+        run("std::unordered_map", [&unordered_map](const Query& key){ return unordered_map.lookup(key); });
+        const SortedArrayBaseline<KeyType> sorted_array(keys, vals, default_value);
+        run("sorted array", [&sorted_array](const Query& key){ return sorted_array.lookup(key); });
+    }
+
+private:
+    std::string key_set;
+    size_t num_keys;
+    size_t repetitions;
+    std::vector<KeyType> misses;
+    std::vector<std::vector<Query>> queries;
+    std::vector<BenchmarkResult>& results;
+};
+
+//Distinct lowercase identifiers of 4 to 16 characters
+static std::vector<std::string> makeRandomKeys(size_t count, uint64_t seed){
+    static constexpr char alphabet[] = "abcdefghijklmnopqrstuvwxyz_";
+    std::mt19937_64 rng(seed);
+    std::uniform_int_distribution<size_t> pick_size(4, 16);
+    std::uniform_int_distribution<size_t> pick_char(0, sizeof(alphabet)-2);
+
+    std::unordered_set<std::string> unique;
+    std::vector<std::string> keys;
+    while(keys.size() < count){
+        std::string key(pick_size(rng), ' ');
+        for(char& c : key) c = alphabet[pick_char(rng)];
+        if(unique.insert(key).second) keys.push_back(std::move(key));
+    }
+
+    return keys;
+}
+
+static void runRuntimeMaps(const std::vector<std::string>& keys, const std::vector<std::string>& vals, const BenchmarkOptions& options, std::vector<BenchmarkResult>& results){
+    KeySetBenchmark<std::string> benchmark("random", keys, options, results);
+    SearchOptions search;
+    search.num_threads = 0;
+
+    PoifectRuntimeMap<std::string> runtime;
+    if(!runtime.build(keys, vals, "", 2, 1, 1, search)){
+        std::fputs("cannot build the runtime map\n", stderr);
+        std::exit(EXIT_FAILURE);
+    }
+    benchmark.run("PoifectRuntimeMap", [&runtime](std::string_view key){ return runtime.lookup(key); });
+
+    SearchOptions partitioned = search;
+    partitioned.partition_size = 3000;
+    PoifectRuntimeMap<std::string> runtime_partitioned;
+    if(!runtime_partitioned.build(keys, vals, "", 2, 1, 1, partitioned)){
+        std::fputs("cannot build the partitioned runtime map\n", stderr);
+        std::exit(EXIT_FAILURE);
+    }
+    benchmark.run("partitioned", [&runtime_partitioned](std::string_view key){ return runtime_partitioned.lookup(key); });
+
+    const std::string path = "poifect_benchmark.map";
+    PoifectMappedMap<std::string> mapped;
+    if(!PoifectMappedMap<std::string>::write(runtime, path) || !mapped.open(path)){
+        std::fprintf(stderr, "cannot write and open %s\n", path.c_str());
+        std::exit(EXIT_FAILURE);
+    }
+    benchmark.run("PoifectMappedMap", [&mapped](std::string_view key){ return mapped.lookup(key); });
+    mapped.close();
+    std::remove(path.c_str());
+
+    benchmark.runBaselines(keys, vals, "");
+}
+
+int main(int argc, char** argv){
+    BenchmarkOptions options;
+    if(!parseArgs(argc, argv, options)) return EXIT_FAILURE;
+
+#ifndef __OPTIMIZE__
+    std::fputs("warning: built without optimization, timings are not representative\n", stderr);
+#endif
+
+    std::vector<BenchmarkResult> results;
+    std::printf("%-10s %-24s %-16s %9s %9s %9s %9s %9s %9s\n",
+                "keys", "map", "stream", "mean ns", "p50 ns", "p90 ns", "p99 ns", "p99.9 ns", "max ns");
+
+    {
+        KeySetBenchmark<std::string> benchmark("cpp", cpp_keywords, options, results);
+#ifdef POIFECT_GENERATED_MAPS
+        benchmark.run("CppKeywords", [](std::string_view key){ return CppKeywords::lookup(key); });
+        benchmark.run("CppKeywords2", [](std::string_view key){ return CppKeywords2::lookup(key); });
+        benchmark.run("CppKeywords2Minimal", [](std::string_view key){ return CppKeywords2Minimal::lookup(key); });
+        benchmark.run("CppKeywords2Partitioned", [](std::string_view key){ return CppKeywords2Partitioned::lookup(key); });
+        benchmark.run("switch", [](std::string_view key){ return CppKeywordsSwitch::lookup(key); });
+#endif
+        benchmark.runBaselines(cpp_keywords, cpp_vals, "IDENTIFIER");
+    }
+
+    {
+        KeySetBenchmark<std::string> benchmark("greek", greek_keywords, options, results);
+#ifdef POIFECT_GENERATED_MAPS
+        benchmark.run("GreekLetters", [](std::string_view key){ return GreekLetters::lookup(key); });
+        benchmark.run("GreekLetters2", [](std::string_view key){ return GreekLetters2::lookup(key); });
+        benchmark.run("switch", [](std::string_view key){ return GreekLettersSwitch::lookup(key); });
+#endif
+        benchmark.runBaselines(greek_keywords, greek_vals, "");
+    }
+
+    {
+        KeySetBenchmark<uint16_t> benchmark("symbols", symbols, options, results);
+#ifdef POIFECT_GENERATED_MAPS
+        benchmark.run("AdhocSymbols", [](uint16_t key){ return AdhocSymbols::lookup(key); });
+        benchmark.run("AdhocSymbols2", [](uint16_t key){ return AdhocSymbols2::lookup(key); });
+        benchmark.run("switch", [](uint16_t key){ return AdhocSymbolsSwitch::lookup(key); });
+#endif
+        benchmark.runBaselines(symbols, symbol_vals, "");
+    }
+
+    if(options.random_keys){
+        const std::vector<std::string> keys = makeRandomKeys(options.random_keys, options.seed);
+        std::vector<std::string> vals;
+        for(size_t i = 0; i < keys.size(); i++) vals.push_back(std::to_string(i));
+        runRuntimeMaps(keys, vals, options, results);
+    }
+
+    if(!options.json_path.empty()){
+#if defined(__VERSION__)
+        const std::string compiler = __VERSION__;
+#else
+        const std::string compiler = "unknown";
+#endif
+#ifdef __OPTIMIZE__
+        const bool optimized = true;
+#else
+        const bool optimized = false;
+#endif
+        std::ofstream out(options.json_path);
+        out << benchmarkJson(results, {
+            {"compiler", jsonStr(compiler)},
+            {"optimized", optimized ? "true" : "false"},
+            {"seed", std::to_string(options.seed)},
+            {"queries", std::to_string(options.queries)},
+            {"repetitions", std::to_string(options.repetitions)},
+            {"sample_size", std::to_string(sample_size)},
+        });
+        if(!out){
+            std::fprintf(stderr, "cannot write %s\n", options.json_path.c_str());
+            return EXIT_FAILURE;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
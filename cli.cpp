@@ -0,0 +1,395 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <vector>
+#include "hashinput.h"
+#include "hashmapped.h"
+#include "hashsearch.h"
+#include "hashsearch2.h"
+#include "hashtuner.h"
+
+//Headless generator: reads key/value rows from a file or stdin and writes a header as HashSearch's
+//saveToFile() does, or a PoifectMappedMap file. Progress and timings go to stderr.
+
+static const char* usage =
+    "Usage: PoifectCli [options] [input]\n"
+    "Reads key/value rows, one per line, from input or stdin and writes a perfect hash map.\n"
+    "\n"
+    "  -d, --delimiter C    character between key and value (default ,)\n"
+    "  -n, --name NAME      generated class name (default PoifectMap)\n"
+    "  -o, --output PATH    header to write (default stdout)\n"
+    "  -m, --map PATH       write a PoifectMappedMap file instead of a header\n"
+    "      --default VALUE  value returned for non-keys (default empty)\n"
+    "      --engine 1|2     hashSearch() or hashSearch2() (default 2)\n"
+    "      --int            keys are unsigned 32-bit integers\n"
+    "  -e, --expansion N    (default 1)\n"
+    "  -r, --reduction N    (default 1)\n"
+    "      --key-only       lookups may assume every query is a key\n"
+    "  -j, --threads N      worker threads, 0 for one per hardware thread (default 0)\n"
+    "      --cost-ordered   engine 1 takes the cheapest hash rather than the first found\n"
+    "      --compact-seeds\n"
+    "      --interleave-slots\n"
+    "      --multiply-shift\n"
+    "      --load-factor X\n"
+    "      --key-positions\n"
+    "      --partition-size N\n"
+    "      --stash N        let up to N keys no hash places go to a scanned stash\n"
+    "      --stats          print what the search did to stderr\n"
+    "      --tune           sweep engines and table sizes, then generate the fastest\n"
+    "                       configuration; replaces --engine, -e, -r, --multiply-shift\n"
+    "                       and --load-factor\n"
+    "      --queries PATH   lookups to time while tuning, one per line (default the keys)\n"
+    "      --memory-budget N  largest tables, in bytes, that tuning may pick\n";
+
+struct CliOptions{
+    char delimiter = ',';
+    std::string name = "PoifectMap";
+    std::string output;
+    std::string map_path;
+    std::string input;
+    std::string default_value;
+    unsigned engine = 2;
+    bool int_keys = false;
+    unsigned expansion = 1;
+    unsigned reduction = 1;
+    bool nonKeyLookups = true;
+    bool stats = false;
+    bool tune = false;
+    std::string queries;
+    size_t memory_budget = 0;
+    SearchOptions search;
+    TunedConfig tuned; //What --tune picked, with the tables its search found
+};
+
+static bool parseUnsigned(const char* str, unsigned max, unsigned& val){
+    char* end;
+    const unsigned long parsed = std::strtoul(str, &end, 10);
+    if(*str == '\0' || *end != '\0' || *str == '-' || parsed > max) return false;
+    val = unsigned(parsed);
+    return true;
+}
+
+static bool parseArgs(int argc, char** argv, CliOptions& cli){
+    cli.search.num_threads = 0;
+
+    for(int i = 1; i < argc; i++){
+        const std::string arg = argv[i];
+        auto value = [&]() -> const char*{
+            if(i+1 == argc){
+                std::fprintf(stderr, "%s requires a value\n", arg.c_str());
+                return nullptr;
+            }
+            return argv[++i];
+        };
+        const char* val = nullptr;
+
+        if(arg == "-h" || arg == "--help"){
+            std::fputs(usage, stdout);
+            std::exit(EXIT_SUCCESS);
+        }else if(arg == "-d" || arg == "--delimiter"){
+            if(!(val = value())) return false;
+            if(std::strlen(val) != 1){
+                std::fputs("delimiter must be single char\n", stderr);
+                return false;
+            }
+            cli.delimiter = val[0];
+        }else if(arg == "-n" || arg == "--name"){
+            if(!(val = value())) return false;
+            cli.name = val;
+        }else if(arg == "-o" || arg == "--output"){
+            if(!(val = value())) return false;
+            cli.output = val;
+        }else if(arg == "-m" || arg == "--map"){
+            if(!(val = value())) return false;
+            cli.map_path = val;
+        }else if(arg == "--default"){
+            if(!(val = value())) return false;
+            cli.default_value = val;
+        }else if(arg == "--engine"){
+            if(!(val = value())) return false;
+            if(!parseUnsigned(val, 2, cli.engine) || cli.engine == 0){
+                std::fputs("engine must be 1 or 2\n", stderr);
+                return false;
+            }
+        }else if(arg == "--int"){
+            cli.int_keys = true;
+        }else if(arg == "-e" || arg == "--expansion"){
+            if(!(val = value())) return false;
+            if(!parseUnsigned(val, 255, cli.expansion) || cli.expansion == 0){
+                std::fputs("expansion must be a whole number from 1 to 255\n", stderr);
+                return false;
+            }
+        }else if(arg == "-r" || arg == "--reduction"){
+            if(!(val = value())) return false;
+            if(!parseUnsigned(val, 255, cli.reduction) || cli.reduction == 0){
+                std::fputs("reduction must be a whole number from 1 to 255\n", stderr);
+                return false;
+            }
+        }else if(arg == "--key-only"){
+            cli.nonKeyLookups = false;
+        }else if(arg == "-j" || arg == "--threads"){
+            if(!(val = value())) return false;
+            if(!parseUnsigned(val, 1024, cli.search.num_threads)){
+                std::fputs("threads must be a whole number\n", stderr);
+                return false;
+            }
+        }else if(arg == "--cost-ordered"){
+            cli.search.cost_ordered = true;
+        }else if(arg == "--compact-seeds"){
+            cli.search.compact_seeds = true;
+        }else if(arg == "--interleave-slots"){
+            cli.search.interleave_slots = true;
+        }else if(arg == "--multiply-shift"){
+            cli.search.multiply_shift = true;
+        }else if(arg == "--load-factor"){
+            if(!(val = value())) return false;
+            char* end;
+            cli.search.load_factor = std::strtod(val, &end);
+            if(*end != '\0' || !(cli.search.load_factor > 0.0 && cli.search.load_factor <= 1.0)){
+                std::fputs("load factor must be in (0, 1]\n", stderr);
+                return false;
+            }
+        }else if(arg == "--key-positions"){
+            cli.search.key_positions = true;
+        }else if(arg == "--partition-size"){
+            if(!(val = value())) return false;
+            unsigned partition_size;
+            if(!parseUnsigned(val, std::numeric_limits<unsigned>::max(), partition_size)){
+                std::fputs("partition size must be a whole number\n", stderr);
+                return false;
+            }
+            cli.search.partition_size = partition_size;
+        }else if(arg == "--stash"){
+            if(!(val = value())) return false;
+            unsigned stash_size;
+            if(!parseUnsigned(val, std::numeric_limits<unsigned>::max(), stash_size)){
+                std::fputs("stash size must be a whole number\n", stderr);
+                return false;
+            }
+            cli.search.stash_size = stash_size;
+        }else if(arg == "--stats"){
+            cli.stats = true;
+        }else if(arg == "--tune"){
+            cli.tune = true;
+        }else if(arg == "--queries"){
+            if(!(val = value())) return false;
+            cli.queries = val;
+        }else if(arg == "--memory-budget"){
+            if(!(val = value())) return false;
+            char* end;
+            cli.memory_budget = std::strtoull(val, &end, 10);
+            if(*val == '\0' || *val == '-' || *end != '\0' || cli.memory_budget == 0){
+                std::fputs("memory budget must be a positive whole number of bytes\n", stderr);
+                return false;
+            }
+        }else if(arg.size() > 1 && arg[0] == '-'){
+            std::fprintf(stderr, "unknown option %s\n%s", arg.c_str(), usage);
+            return false;
+        }else if(cli.input.empty()){
+            cli.input = arg;
+        }else{
+            std::fputs("only one input may be given\n", stderr);
+            return false;
+        }
+    }
+
+    if((!cli.queries.empty() || cli.memory_budget) && !cli.tune){
+        std::fputs("--queries and --memory-budget require --tune\n", stderr);
+        return false;
+    }
+
+    if(cli.engine == 1 && cli.reduction > cli.expansion){
+        std::fputs("single-layer map requires reduction <= expansion\n", stderr);
+        return false;
+    }
+
+    return true;
+}
+
+//A stash too small for every trial is reported with the size that would have been enough
+static void reportFailure(const SearchStats& stats){
+    if(stats.needed_stash)
+        std::fprintf(stderr, "no suitable hash function found; --stash %zu would place every key\n", size_t(stats.needed_stash));
+    else
+        std::fputs("no suitable hash function found\n", stderr);
+}
+
+static bool writeHeader(const std::string& hash_str, const std::string& path){
+    std::FILE* out = path.empty() ? stdout : std::fopen(path.c_str(), "wb");
+    if(!out){
+        std::fprintf(stderr, "cannot open %s\n", path.c_str());
+        return false;
+    }
+
+    bool written = std::fwrite(hash_str.data(), 1, hash_str.size(), out) == hash_str.size();
+    written &= (path.empty() ? std::fflush(out) : std::fclose(out)) == 0;
+    if(!written) std::fprintf(stderr, "cannot write %s\n", path.empty() ? "stdout" : path.c_str());
+
+    return written;
+}
+
+//Queries are keys as in the rows, one per line, with no value
+template<typename KeyType>
+static bool readQueries(const std::string& path, std::vector<KeyType>& queries, std::string& error){
+    std::FILE* in = std::fopen(path.c_str(), "rb");
+    if(!in){
+        error = "cannot open " + path;
+        return false;
+    }
+
+    std::string text;
+    char buffer[1 << 16];
+    for(size_t read; (read = std::fread(buffer, 1, sizeof(buffer), in)) > 0;) text.append(buffer, read);
+    const bool read_error = std::ferror(in);
+    std::fclose(in);
+    if(read_error){
+        error = "cannot read " + path;
+        return false;
+    }
+
+    size_t line = 0;
+    for(size_t start = 0; start < text.size();){
+        size_t end = text.find('\n', start);
+        if(end == std::string::npos) end = text.size();
+        std::string_view query(text.data() + start, end - start);
+        if(!query.empty() && query.back() == '\r') query.remove_suffix(1);
+        start = end + 1;
+        line++;
+
+        KeyType key;
+        if(!parseKey(query, key)){
+            error = path + " line " + std::to_string(line) + " is not a valid integer key";
+            return false;
+        }
+        queries.push_back(std::move(key));
+    }
+
+    if(queries.empty()){
+        error = path + " holds no queries";
+        return false;
+    }
+
+    return true;
+}
+
+//Replaces the engine and table parameters of cli with the best configuration for its keys
+template<typename KeyType>
+static bool tune(const std::vector<KeyType>& keys, const std::vector<std::string>& vals, CliOptions& cli){
+    std::vector<KeyType> sample;
+    std::string error;
+    if(cli.queries.empty()) sample = keys;
+    else if(!readQueries(cli.queries, sample, error)){
+        std::fprintf(stderr, "%s\n", error.c_str());
+        return false;
+    }
+
+    const std::vector<typename PoifectRuntimeMap<KeyType>::Query> queries(sample.begin(), sample.end());
+    const std::vector<TunedConfig> configs = tuneMap(keys, vals, queries, cli.default_value, cli.nonKeyLookups, cli.search);
+    std::fputs(tuningTable(configs).c_str(), stderr);
+
+    TunedConfig best;
+    if(!bestConfig(configs, best, cli.memory_budget)){
+        std::fputs(configs.empty() ? "no suitable hash function found\n" : "no configuration fits the memory budget\n", stderr);
+        return false;
+    }
+    std::fprintf(stderr, "tuned: %s (%zu table bytes, %.2f ns per lookup)\n", best.args().c_str(), best.table_bytes, best.lookup_ns);
+
+    cli.engine = best.engine;
+    cli.expansion = best.expansion;
+    cli.reduction = best.reduction;
+    cli.search = best.options;
+    cli.tuned = best;
+
+    return true;
+}
+
+template<typename KeyType>
+static int run(CliOptions& cli){
+    std::FILE* in = cli.input.empty() ? stdin : std::fopen(cli.input.c_str(), "rb");
+    if(!in){
+        std::fprintf(stderr, "cannot open %s\n", cli.input.c_str());
+        return EXIT_FAILURE;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<KeyType> keys;
+    std::vector<std::string> vals;
+    std::string error;
+    const bool read = readRows(in, cli.delimiter, keys, vals, error);
+    if(in != stdin) std::fclose(in);
+    if(!read){
+        std::fprintf(stderr, "%s\n", error.c_str());
+        return EXIT_FAILURE;
+    }
+    std::fprintf(stderr, "read %zu rows in %.2fs\n", keys.size(), secondsSince(start));
+
+    if(keys.size() < 2){
+        std::fputs("require at least 2 entries\n", stderr);
+        return EXIT_FAILURE;
+    }
+
+    start = std::chrono::steady_clock::now();
+    size_t first, second;
+    if(findDuplicate(keys, first, second)){
+        std::fprintf(stderr, "key on line %zu duplicates key on line %zu\n", second+1, first+1);
+        return EXIT_FAILURE;
+    }
+    std::fprintf(stderr, "checked for duplicates in %.2fs\n", secondsSince(start));
+
+    if(cli.tune){
+        start = std::chrono::steady_clock::now();
+        if(!tune(keys, vals, cli)) return EXIT_FAILURE;
+        std::fprintf(stderr, "tuned in %.2fs\n", secondsSince(start));
+    }
+
+    start = std::chrono::steady_clock::now();
+    if(!cli.map_path.empty()){
+        PoifectRuntimeMap<KeyType> map;
+        SearchStats stats;
+        const bool built = cli.tuned.tables ? buildTuned(map, keys, vals, cli.tuned, cli.default_value, &stats)
+                                            : map.build(keys, vals, cli.default_value, uint8_t(cli.engine), uint8_t(cli.expansion), uint8_t(cli.reduction), cli.search, &stats);
+        if(cli.stats) std::fprintf(stderr, "%s\n", stats.summary().c_str());
+        if(!built){
+            reportFailure(stats);
+            return EXIT_FAILURE;
+        }
+        std::fprintf(stderr, "searched in %.2fs\n", secondsSince(start));
+
+        start = std::chrono::steady_clock::now();
+        if(!PoifectMappedMap<KeyType>::write(map, cli.map_path)){
+            std::fprintf(stderr, "cannot write %s\n", cli.map_path.c_str());
+            return EXIT_FAILURE;
+        }
+        std::fprintf(stderr, "wrote %s in %.2fs\n", cli.map_path.c_str(), secondsSince(start));
+
+        return EXIT_SUCCESS;
+    }
+
+    std::string hash_str;
+    SearchStats stats;
+    bool success;
+    if(cli.tuned.tables)
+        success = writeTuned(keys, vals, cli.tuned, hash_str, cli.name, cli.default_value, cli.nonKeyLookups, &stats);
+    else if(cli.engine == 2)
+        success = hashSearch2<KeyType>(keys, vals, hash_str, cli.name, cli.default_value, uint8_t(cli.expansion), uint8_t(cli.reduction), cli.nonKeyLookups, cli.search, &stats);
+    else
+        success = hashSearch<KeyType>(keys, vals, hash_str, cli.name, cli.default_value, uint8_t(cli.expansion), uint8_t(cli.reduction), cli.nonKeyLookups, cli.search, &stats);
+    if(cli.stats) std::fprintf(stderr, "%s\n", stats.summary().c_str());
+    if(!success){
+        reportFailure(stats);
+        return EXIT_FAILURE;
+    }
+    std::fprintf(stderr, "searched and generated in %.2fs\n", secondsSince(start));
+
+    return writeHeader(hash_str, cli.output) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int main(int argc, char** argv){
+    CliOptions cli;
+    if(!parseArgs(argc, argv, cli)) return EXIT_FAILURE;
+
+    return cli.int_keys ? run<uint32_t>(cli) : run<std::string>(cli);
+}
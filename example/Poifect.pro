@@ -2,7 +2,10 @@ QT += core gui
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
-CONFIG += c++11
+CONFIG += c++17
+
+# The hash headers use names such as slots that the Qt keyword macros would expand away
+CONFIG += no_keywords
 
 DEFINES += QT_DEPRECATED_WARNINGS
 
@@ -8,6 +8,7 @@ static MainWindow* main_window;
 
 MainWindow::MainWindow(QWidget* parent)
     : QMainWindow(parent)
+    , previous(new SearchResult2)
     , ui(new Ui::MainWindow){
     ui->setupUi(this);
     main_window = this;
@@ -19,11 +20,16 @@ MainWindow::MainWindow(QWidget* parent)
     connect(ui->layerCheckBox, SIGNAL(stateChanged(int)), this, SLOT(parseInputField()));
     connect(ui->intCheckBox, SIGNAL(stateChanged(int)), this, SLOT(parseInputField()));
     connect(ui->delimiterEdit, SIGNAL(editingFinished()), this, SLOT(parseInputField()));
+    connect(&progress_timer, SIGNAL(timeout()), this, SLOT(updateProgress()));
 
     parseInputField();
 }
 
 MainWindow::~MainWindow(){
+    if(search_thread.joinable()){
+        progress.cancel = true;
+        search_thread.join();
+    }
     delete ui;
 }
 
@@ -65,21 +71,19 @@ void MainWindow::parseInputField(){
             return;
         }
 
-        std::string key = entries[0].toString().toStdString();
-        for(int j = 0; j < i; j++){
-            if(keys[j] == key){
-                ui->outputEdit->setText("Key on row " + QString::number(i+1) +
-                                        " duplicates key on row " + QString::number(j+1));
-                ui->pushButton->setEnabled(false);
-                ui->statusLabel->setText("(╯°□°）╯︵ ┻━┻   Input error");
-                return;
-            }
-        }
-
-        keys.push_back(key);
+        keys.push_back(entries[0].toString().toStdString());
         vals.push_back(entries[1].toString().toStdString());
     }
 
+    size_t first, second;
+    if(findDuplicate(keys, first, second)){
+        ui->outputEdit->setText("Key on row " + QString::number(second+1) +
+                                " duplicates key on row " + QString::number(first+1));
+        ui->pushButton->setEnabled(false);
+        ui->statusLabel->setText("(╯°□°）╯︵ ┻━┻   Input error");
+        return;
+    }
+
     bool success;
     expansion = ui->expansionEdit->text().toUInt(&success);
 
@@ -129,51 +133,112 @@ void MainWindow::parseInputField(){
     ui->statusLabel->setText(":)    Ready to search");
 }
 
+void MainWindow::setInputsEnabled(bool enabled){
+    ui->inputEdit->setEnabled(enabled);
+    ui->expansionEdit->setEnabled(enabled);
+    ui->reductionEdit->setEnabled(enabled);
+    ui->intCheckBox->setEnabled(enabled);
+    ui->layerCheckBox->setEnabled(enabled);
+    ui->defaultEdit->setEnabled(enabled);
+    ui->delimiterEdit->setEnabled(enabled);
+    ui->nameEdit->setEnabled(enabled);
+    ui->keyOnlyCheckBox->setEnabled(enabled);
+}
+
+//Starts a search on search_thread, or cancels the running one
 void MainWindow::writeHashFunction(){
-    QString old_btn_msg = ui->pushButton->text();
+    if(search_thread.joinable()){
+        progress.cancel = true;
+        ui->pushButton->setEnabled(false);
+        ui->statusLabel->setText("...   Terminating");
+        return;
+    }
+
+    old_btn_msg = ui->pushButton->text();
     ui->pushButton->setText("Terminate");
-    ui->inputEdit->setEnabled(false);
-    ui->expansionEdit->setEnabled(false);
-    ui->reductionEdit->setEnabled(false);
-    ui->intCheckBox->setEnabled(false);
-    ui->layerCheckBox->setEnabled(false);
-    ui->defaultEdit->setEnabled(false);
-    ui->delimiterEdit->setEnabled(false);
-    ui->nameEdit->setEnabled(false);
-
-    std::string dflt = ui->defaultEdit->text().toStdString();
-    std::string name = ui->nameEdit->text().toStdString();
-    bool nonKeyLookup = !ui->keyOnlyCheckBox->isChecked();
-    std::string hash_str;
-    bool success;
+    setInputsEnabled(false);
+
+    //The thread gets its own copies, so nothing it reads changes under it
+    const std::string dflt = ui->defaultEdit->text().toStdString();
+    const std::string name = ui->nameEdit->text().toStdString();
+    const bool nonKeyLookup = !ui->keyOnlyCheckBox->isChecked();
+    const bool int_keys = ui->intCheckBox->isChecked();
+    const bool two_layer = ui->layerCheckBox->isChecked();
+    const uint8_t expansion = uint8_t(this->expansion);
+    const uint8_t reduction = uint8_t(this->reduction);
+    const std::vector<std::string> keys = this->keys;
+    const std::vector<uint32_t> number_keys = this->number_keys;
+    const std::vector<std::string> vals = this->vals;
+
+    progress.reset();
+    search_done = false;
+    SearchOptions options;
+    options.progress = &progress;
+
+    //The previous tables are only rebuilt for the same key type and table sizes
+    if(int_keys != previous_int_keys || expansion != previous_expansion || reduction != previous_reduction){
+        *previous = SearchResult2();
+        previous_int_keys = int_keys;
+        previous_expansion = expansion;
+        previous_reduction = reduction;
+    }
 
-    if(ui->intCheckBox->isChecked()){
-        if(ui->layerCheckBox->isChecked())
-            success = hashSearch2<uint32_t>(number_keys, vals, hash_str, name, dflt, expansion, reduction, nonKeyLookup);
-        else
-            success = hashSearch<uint32_t>(number_keys, vals, hash_str, name, dflt, expansion, reduction, nonKeyLookup);
-    }else{
-        if(ui->layerCheckBox->isChecked())
-            success = hashSearch2<std::string>(keys, vals, hash_str, name, dflt, expansion, reduction, nonKeyLookup);
-        else
-            success = hashSearch<std::string>(keys, vals, hash_str, name, dflt, expansion, reduction, nonKeyLookup);
+    search_thread = std::thread([=](){
+        if(int_keys){
+            if(two_layer){
+                success = hashRebuild2<uint32_t>(previous_number_keys, *previous, number_keys, vals, hash_str, name, dflt, expansion, reduction, nonKeyLookup, options, &stats);
+                if(success) previous_number_keys = number_keys;
+            }else{
+                success = hashSearch<uint32_t>(number_keys, vals, hash_str, name, dflt, expansion, reduction, nonKeyLookup, options, &stats);
+            }
+        }else{
+            if(two_layer){
+                success = hashRebuild2<std::string>(previous_keys, *previous, keys, vals, hash_str, name, dflt, expansion, reduction, nonKeyLookup, options, &stats);
+                if(success) previous_keys = keys;
+            }else{
+                success = hashSearch<std::string>(keys, vals, hash_str, name, dflt, expansion, reduction, nonKeyLookup, options, &stats);
+            }
+        }
+        search_done = true;
+    });
+
+    progress_timer.start(100);
+    updateProgress();
+}
+
+void MainWindow::updateProgress(){
+    if(search_done){
+        finishSearch();
+        return;
     }
 
+    if(progress.cancelled()) return;
+    QString status = "...   Searching: " + QString::number(progress.candidates) + " candidates tried";
+    if(ui->layerCheckBox->isChecked()) status += ", " + QString::number(progress.bins_placed) + " bins placed";
+    ui->statusLabel->setText(status);
+}
+
+void MainWindow::finishSearch(){
+    progress_timer.stop();
+    search_thread.join();
+
     if(success){
         ui->outputEdit->setText(QString::fromStdString(hash_str));
         ui->statusLabel->setText(":D   Victory!");
+    }else if(stats.cancelled){
+        ui->outputEdit->setText("Search Terminated\n\n" + QString::fromStdString(stats.summary()));
+        ui->statusLabel->setText(":|   Search terminated");
     }else{
-        ui->outputEdit->setText("Search Failed");
+        ui->outputEdit->setText("Search Failed\n\n" + QString::fromStdString(stats.summary()));
         ui->statusLabel->setText(":'(   No suitable hash function found");
     }
 
+    //The whole summary is a tooltip away, the status bar only has room for one line
+    const QString summary = QString::fromStdString(stats.summary());
+    ui->statusbar->showMessage(QString(summary).replace('\n', "  |  "));
+    ui->statusbar->setToolTip(summary);
+
     ui->pushButton->setText(old_btn_msg);
-    ui->inputEdit->setEnabled(true);
-    ui->expansionEdit->setEnabled(true);
-    ui->reductionEdit->setEnabled(true);
-    ui->intCheckBox->setEnabled(true);
-    ui->layerCheckBox->setEnabled(true);
-    ui->defaultEdit->setEnabled(true);
-    ui->delimiterEdit->setEnabled(true);
-    ui->nameEdit->setEnabled(true);
+    ui->pushButton->setEnabled(true);
+    setInputsEnabled(true);
 }
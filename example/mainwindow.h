@@ -2,6 +2,15 @@
 #define MAINWINDOW_H
 
 #include <QMainWindow>
+#include <QTimer>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../hashoptions.h"
+
+struct SearchResult2;
 
 QT_BEGIN_NAMESPACE
 namespace Ui { class MainWindow; }
@@ -19,13 +28,37 @@ private:
     uint expansion;
     uint reduction;
 
+    //The search runs on search_thread, which sets search_done when it returns. progress_timer polls it and
+    //the counters in progress, so the window stays responsive and the button can cancel.
+    std::thread search_thread;
+    std::atomic<bool> search_done {false};
+    SearchProgress progress;
+    QTimer progress_timer;
+    QString old_btn_msg;
+    std::string hash_str;
+    SearchStats stats;
+    bool success = false;
+
+    //The tables of the last two-layer search and the keys and settings they were found for, so that an edit
+    //to the keys rebuilds them instead of searching again
+    std::unique_ptr<SearchResult2> previous;
+    std::vector<std::string> previous_keys;
+    std::vector<uint32_t> previous_number_keys;
+    bool previous_int_keys = false;
+    uint previous_expansion = 0;
+    uint previous_reduction = 0;
+
+    void setInputsEnabled(bool enabled);
+    void finishSearch();
+
 public:
     MainWindow(QWidget* parent = nullptr);
     ~MainWindow();
     Ui::MainWindow* ui;
 
-private slots:
+private Q_SLOTS:
     void parseInputField();
     void writeHashFunction();
+    void updateProgress();
 };
 #endif // MAINWINDOW_H
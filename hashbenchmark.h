@@ -1,9 +1,34 @@
 #ifndef HASHBENCHMARK_H
 #define HASHBENCHMARK_H
 
+#include <algorithm>
 #include <chrono>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
 #include <iostream>
+#include <limits>
+#include <map>
+#include <random>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
 #include <vector>
+#include "hashutil.h"
+
+//Keeps the compiler from discarding a lookup whose result is otherwise unused
+template<typename T>
+inline void doNotOptimize(const T& value){
+#if defined(__GNUC__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static volatile const void* sink;
+    sink = &value;
+#endif
+}
 
 template<class Map, typename KeyType>
 void runBenchmark(const std::vector<KeyType> keys){
@@ -12,7 +37,7 @@ void runBenchmark(const std::vector<KeyType> keys){
 
     for(size_t i = 0; i < n; i++)
         for(const auto& key : keys)
-            Map::lookup(key);
+            doNotOptimize(Map::lookup(key));
 
     const auto end = std::chrono::high_resolution_clock::now();
     const auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
@@ -20,4 +45,352 @@ void runBenchmark(const std::vector<KeyType> keys){
     std::cout << "average lookup time: " << 1000*duration.count() / (double)(keys.size()*n) << "ns" << std::endl;
 }
 
+template<class Map, typename KeyType>
+void runBatchBenchmark(const std::vector<KeyType> keys){
+    typedef typename std::conditional<std::is_same<KeyType, std::string>::value, std::string_view, KeyType>::type QueryType;
+    constexpr size_t n = 100000;
+    const std::vector<QueryType> queries(keys.begin(), keys.end());
+    std::vector<std::string_view> out(queries.size());
+    size_t total_size = 0;
+    const auto start = std::chrono::high_resolution_clock::now();
+
+    for(size_t i = 0; i < n; i++){
+        Map::lookup_batch(queries.data(), queries.size(), out.data());
+        total_size += out[i % out.size()].size();
+    }
+
+    const auto end = std::chrono::high_resolution_clock::now();
+    const auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+
+    std::cout << "average lookup time: " << 1000*duration.count() / (double)(keys.size()*n) << "ns"
+              << " (" << total_size << " value bytes)" << std::endl;
+}
+
+//Query streams. Each query is a key with probability hit_ratio and a non-key otherwise, drawn uniformly or
+//with Zipf-distributed popularity. The popularity ranks are shuffled, so the hot keys are spread over the map
+//rather than following the order of the key set.
+enum class QueryDistribution{
+    uniform,
+    zipf,
+};
+
+struct QueryStream{
+    QueryDistribution distribution;
+    double hit_ratio;
+    double zipf_s = 1.0;
+
+    std::string name() const{
+        std::string str = distribution == QueryDistribution::uniform ? "uniform" : "zipf";
+        return str + "/" + std::to_string(int(std::lround(100*hit_ratio))) + "% hits";
+    }
+};
+
+class ZipfDistribution{
+public:
+    ZipfDistribution(size_t n, double s){
+        double sum = 0;
+        for(size_t rank = 1; rank <= n; rank++){
+            sum += 1.0 / std::pow(double(rank), s);
+            cdf.push_back(sum);
+        }
+        for(double& p : cdf) p /= sum;
+    }
+
+    template<typename Rng>
+    size_t operator()(Rng& rng){
+        const double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+        return std::min<size_t>(std::lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin(), cdf.size()-1);
+    }
+
+private:
+    std::vector<double> cdf;
+};
+
+template<typename Query, typename Rng>
+std::vector<Query> makeQueries(std::vector<Query> hits, std::vector<Query> misses, size_t count, const QueryStream& stream, Rng& rng){
+    std::shuffle(hits.begin(), hits.end(), rng);
+    std::shuffle(misses.begin(), misses.end(), rng);
+
+    auto sampler = [&stream](size_t n){
+        return stream.distribution == QueryDistribution::zipf ? ZipfDistribution(n, stream.zipf_s) : ZipfDistribution(n, 0.0);
+    };
+    ZipfDistribution hit_rank = sampler(hits.size());
+    ZipfDistribution miss_rank = sampler(std::max<size_t>(misses.size(), 1));
+    std::bernoulli_distribution is_hit(misses.empty() ? 1.0 : stream.hit_ratio);
+
+    std::vector<Query> queries;
+    queries.reserve(count);
+    for(size_t i = 0; i < count; i++)
+        queries.push_back(is_hit(rng) ? hits[hit_rank(rng)] : misses[miss_rank(rng)]);
+
+    return queries;
+}
+
+//Non-keys shaped like the keys: strings of the same lengths, or integers of the same type
+template<typename Rng>
+std::vector<std::string> makeMisses(const std::vector<std::string>& keys, size_t count, Rng& rng){
+    static constexpr char alphabet[] = "abcdefghijklmnopqrstuvwxyz_";
+    const std::unordered_set<std::string> key_set(keys.begin(), keys.end());
+    std::uniform_int_distribution<size_t> pick_key(0, keys.size()-1);
+    std::uniform_int_distribution<size_t> pick_char(0, sizeof(alphabet)-2);
+
+    //Short keys may leave fewer strings of their lengths than count, less those that are keys
+    constexpr size_t alphabet_size = sizeof(alphabet)-1;
+    std::map<size_t, size_t> available;
+    for(const std::string& key : keys){
+        if(available.count(key.size())) continue;
+        size_t strings = 1;
+        for(size_t i = 0; i < key.size() && strings <= count; i++) strings *= alphabet_size;
+        available[key.size()] = strings;
+    }
+    for(const std::string& key : key_set)
+        if(key.find_first_not_of(alphabet) == std::string::npos && available[key.size()] <= count) available[key.size()]--;
+    size_t total = 0;
+    for(const auto& length : available) total += std::min(length.second, count);
+    count = std::min(count, total);
+
+    std::unordered_set<std::string> misses;
+    while(misses.size() < count){
+        std::string miss(keys[pick_key(rng)].size(), ' ');
+        for(char& c : miss) c = alphabet[pick_char(rng)];
+        if(!key_set.count(miss)) misses.insert(miss);
+    }
+
+    std::vector<std::string> sorted(misses.begin(), misses.end());
+    std::sort(sorted.begin(), sorted.end());
+    return sorted;
+}
+
+template<typename KeyType, typename Rng>
+std::vector<KeyType> makeMisses(const std::vector<KeyType>& keys, size_t count, Rng& rng){
+    const std::unordered_set<KeyType> key_set(keys.begin(), keys.end());
+    std::uniform_int_distribution<uint64_t> pick(0, std::numeric_limits<KeyType>::max());
+    count = std::min<uint64_t>(count, uint64_t(std::numeric_limits<KeyType>::max()) + 1 - key_set.size());
+
+    std::unordered_set<KeyType> misses;
+    while(misses.size() < count){
+        const KeyType miss = KeyType(pick(rng));
+        if(!key_set.count(miss)) misses.insert(miss);
+    }
+
+    std::vector<KeyType> sorted(misses.begin(), misses.end());
+    std::sort(sorted.begin(), sorted.end());
+    return sorted;
+}
+
+//Timings of one map on one query stream. The mean comes from passes timed as a whole. Timing a single
+//lookup costs more than the lookup, so the percentiles are over samples of sample_size consecutive lookups,
+//each divided by sample_size, from separate passes.
+struct BenchmarkResult{
+    std::string key_set;
+    std::string map;
+    std::string stream;
+    double hit_ratio;
+    size_t num_keys;
+    size_t num_queries;
+    double mean_ns;
+    double p50_ns;
+    double p90_ns;
+    double p99_ns;
+    double p999_ns;
+    double max_ns;
+};
+
+constexpr size_t sample_size = 32;
+
+//Runs every query through lookup, a warm-up pass and then repetitions timed passes of each kind. The mean is
+//the median of the timed passes.
+template<typename Query, typename Lookup>
+BenchmarkResult benchmarkLookups(const std::vector<Query>& queries, const Lookup& lookup, size_t repetitions){
+    typedef std::chrono::steady_clock Clock;
+
+    for(const Query& query : queries) doNotOptimize(lookup(query));
+
+    std::vector<double> means;
+    std::vector<double> samples;
+    samples.reserve(repetitions * (queries.size() / sample_size));
+
+    for(size_t r = 0; r < repetitions; r++){
+        const Clock::time_point start = Clock::now();
+        for(const Query& query : queries) doNotOptimize(lookup(query));
+        means.push_back(std::chrono::duration<double, std::nano>(Clock::now() - start).count() / queries.size());
+
+        for(size_t i = 0; i + sample_size <= queries.size(); i += sample_size){
+            const Clock::time_point sample_start = Clock::now();
+            for(size_t j = i; j < i + sample_size; j++) doNotOptimize(lookup(queries[j]));
+            samples.push_back(std::chrono::duration<double, std::nano>(Clock::now() - sample_start).count() / sample_size);
+        }
+    }
+
+    auto percentile = [&samples](double p){
+        if(samples.empty()) return 0.0;
+        return samples[std::min<size_t>(size_t(p * samples.size()), samples.size()-1)];
+    };
+    std::sort(means.begin(), means.end());
+    std::sort(samples.begin(), samples.end());
+
+    BenchmarkResult result {};
+    result.num_queries = queries.size();
+    result.mean_ns = means[means.size()/2];
+    result.p50_ns = percentile(0.5);
+    result.p90_ns = percentile(0.9);
+    result.p99_ns = percentile(0.99);
+    result.p999_ns = percentile(0.999);
+    result.max_ns = samples.empty() ? 0.0 : samples.back();
+
+    return result;
+}
+
+//Baselines built from the same keys and values. Both look string keys up by std::string_view into the key
+//set, as a caller avoiding a std::string per query would.
+template<typename KeyType>
+class UnorderedMapBaseline{
+public:
+    typedef typename std::conditional<std::is_same<KeyType, std::string>::value, std::string_view, KeyType>::type Query;
+
+    UnorderedMapBaseline(const std::vector<KeyType>& keys, const std::vector<std::string>& vals, std::string_view default_value)
+        : default_value(default_value){
+        for(size_t i = 0; i < keys.size(); i++) map.emplace(Query(keys[i]), std::string_view(vals[i]));
+    }
+
+    std::string_view lookup(const Query& key) const{
+        const auto found = map.find(key);
+        return found == map.end() ? default_value : found->second;
+    }
+
+private:
+    std::unordered_map<Query, std::string_view> map;
+    std::string_view default_value;
+};
+
+template<typename KeyType>
+class SortedArrayBaseline{
+public:
+    typedef typename std::conditional<std::is_same<KeyType, std::string>::value, std::string_view, KeyType>::type Query;
+
+    SortedArrayBaseline(const std::vector<KeyType>& keys, const std::vector<std::string>& vals, std::string_view default_value)
+        : default_value(default_value){
+        for(size_t i = 0; i < keys.size(); i++) entries.emplace_back(Query(keys[i]), std::string_view(vals[i]));
+        std::sort(entries.begin(), entries.end());
+    }
+
+    std::string_view lookup(const Query& key) const{
+        const auto found = std::lower_bound(entries.begin(), entries.end(), key,
+                                            [](const std::pair<Query, std::string_view>& entry, const Query& key){ return entry.first < key; });
+        return found != entries.end() && found->first == key ? found->second : default_value;
+    }
+
+private:
+    std::vector<std::pair<Query, std::string_view>> entries;
+    std::string_view default_value;
+};
+
+//Emits a class whose lookup() is a switch over the keys, as a hand-written lexer would have it: on the length
+//and then the first character for string keys, comparing whole keys last, or directly on integer keys
+static inline std::string switchStr(const std::vector<std::string>& keys, const std::vector<std::string>& vals, const std::string& map_name, const std::string& default_value){
+    std::map<size_t, std::map<char, std::vector<size_t>>> cases;
+    for(size_t i = 0; i < keys.size(); i++)
+        cases[keys[i].size()][keys[i].empty() ? '\0' : keys[i][0]].push_back(i);
+
+    std::string str =
+        "    static std::string_view lookup(std::string_view key) noexcept{\n"
+        "        switch(key.size()){\n";
+    for(const auto& size_case : cases){
+        str += "        case " + std::to_string(size_case.first) + ":\n";
+        if(size_case.first == 0){
+            str += "            return " + viewStr(vals[size_case.second.begin()->second[0]]) + ";\n";
+            continue;
+        }
+
+        str += "            switch(key[0]){\n";
+        for(const auto& char_case : size_case.second){
+            const char c = char_case.first;
+            str += "            case " + (std::isalnum(static_cast<unsigned char>(c)) || c == '_' ? "'" + std::string(1, c) + "'" : std::to_string(int(c))) + ":\n";
+            for(size_t i : char_case.second)
+                str += "                if(key == " + viewStr(keys[i]) + ") return " + viewStr(vals[i]) + ";\n";
+            str += "                break;\n";
+        }
+        str += "            }\n"
+               "            break;\n";
+    }
+    str += "        }\n"
+           "\n"
+           "        return " + viewStr(default_value) + ";\n"
+           "    }\n";
+
+    std::string upper_name = map_name;
+    std::transform(upper_name.begin(), upper_name.end(), upper_name.begin(), toupper);
+    return "//CODEGEN FILE\n"
+           "#ifndef POIFECT_" + upper_name + "_H\n"
+           "#define POIFECT_" + upper_name + "_H\n"
+           "#include <string_view>\n"
+           "\n"
+           "class " + map_name + " final{\n"
+           "public:\n"
+           + str +
+           "};\n"
+           "\n"
+           "#endif // POIFECT_" + upper_name + "_H\n";
+}
+
+template<typename KeyType>
+static std::string switchStr(const std::vector<KeyType>& keys, const std::vector<std::string>& vals, const std::string& map_name, const std::string& default_value){
+    std::string upper_name = map_name;
+    std::transform(upper_name.begin(), upper_name.end(), upper_name.begin(), toupper);
+
+    std::string str = "//CODEGEN FILE\n"
+                      "#ifndef POIFECT_" + upper_name + "_H\n"
+                      "#define POIFECT_" + upper_name + "_H\n"
+                      "#include <cstdint>\n"
+                      "#include <string_view>\n"
+                      "\n"
+                      "class " + map_name + " final{\n"
+                      "public:\n"
+                      "    static constexpr std::string_view lookup(uint64_t key) noexcept{\n"
+                      "        switch(key){\n";
+    for(size_t i = 0; i < keys.size(); i++)
+        str += "        case " + std::to_string(keys[i]) + ": return " + viewStr(vals[i]) + ";\n";
+    str += "        default: return " + viewStr(default_value) + ";\n"
+           "        }\n"
+           "    }\n"
+           "};\n"
+           "\n"
+           "#endif // POIFECT_" + upper_name + "_H\n";
+
+    return str;
+}
+
+static inline std::string jsonStr(const std::string& str){
+    std::string escaped = "\"";
+    for(char c : str){
+        if(c == '"' || c == '\\') escaped += '\\';
+        escaped += c;
+    }
+    return escaped + "\"";
+}
+
+//One JSON object holding the run's settings and a record per result
+static inline std::string benchmarkJson(const std::vector<BenchmarkResult>& results, const std::vector<std::pair<std::string, std::string>>& settings){
+    std::string str = "{\n";
+    for(const auto& setting : settings)
+        str += "  " + jsonStr(setting.first) + ": " + setting.second + ",\n";
+    str += "  \"results\": [\n";
+
+    for(size_t i = 0; i < results.size(); i++){
+        const BenchmarkResult& result = results[i];
+        str += "    {\"key_set\": " + jsonStr(result.key_set) + ", \"map\": " + jsonStr(result.map)
+             + ", \"stream\": " + jsonStr(result.stream) + ", \"hit_ratio\": " + std::to_string(result.hit_ratio)
+             + ", \"keys\": " + std::to_string(result.num_keys) + ", \"queries\": " + std::to_string(result.num_queries)
+             + ", \"mean_ns\": " + std::to_string(result.mean_ns) + ", \"p50_ns\": " + std::to_string(result.p50_ns)
+             + ", \"p90_ns\": " + std::to_string(result.p90_ns) + ", \"p99_ns\": " + std::to_string(result.p99_ns)
+             + ", \"p999_ns\": " + std::to_string(result.p999_ns) + ", \"max_ns\": " + std::to_string(result.max_ns) + "}"
+             + (i+1 < results.size() ? ",\n" : "\n");
+    }
+
+    str += "  ]\n"
+           "}\n";
+
+    return str;
+}
+
 #endif // HASHBENCHMARK_H
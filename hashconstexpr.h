@@ -0,0 +1,201 @@
+#ifndef HASHCONSTEXPR_H
+#define HASHCONSTEXPR_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string_view>
+#include <utility>
+
+//Compile-time construction of hashSearch2() string maps. make_map() runs the two-layer displacement search
+//inside the compiler and returns a map holding the tables writeHash2() would emit: the layer-1 seed s0, a
+//uint16_t seed per layer-1 bin, and the key and value of each final slot. There's no HashSearch step and
+//no generated header, and nothing is left to do at startup.
+//
+//The hash, the seed s0 candidates, the bin limit and the order bins are placed in all follow hashSearch2()
+//with default SearchOptions and expansion 1, so both find the same seeds for the same keys.
+//
+//Limits: every step of the search counts towards the compiler's constant evaluation budget, which is
+//-fconstexpr-ops-limit (2^25 by default) for GCC and -fconstexpr-steps (2^20 by default) for Clang.
+//Measured with GCC 12 at -O2 on random keys of 3 to 12 characters, including about 0.5s to compile an empty
+//translation unit with this header:
+//    keys    reduction 1    reduction 4
+//     200           0.7s           0.7s
+//    1000           2.1s    over budget
+//    4000           6.6s
+//    8000    over budget
+//The 48 Greek letters in main.cpp take 0.6s, and 8000 keys take 11s with -fconstexpr-ops-limit=268435456.
+//Fuller layer-1 bins need more seed trials, so higher reductions run out of budget sooner. The Clang budget
+//counts differently and wasn't measured. Key sets past these sizes are better served by a generated header.
+//A key set that no seed s0 separates, or one with duplicate keys, is a compile error when make_map() is
+//constant evaluated.
+namespace poifect{
+
+namespace detail{
+
+constexpr size_t max_keys1 = 10;
+
+constexpr uint8_t primes[] = {  0,   1,   2,   3,   5,
+                                7,  11,  13,  17,  19,
+                               23,  29,  31,  37,  41,
+                               43,  47,  53,  59,  61,
+                               67,  71,  73,  79,  83,
+                               89,  97, 101, 103, 107,
+                              109, 113};
+
+constexpr uint32_t hash(std::string_view key, uint32_t coeff) noexcept{
+    uint32_t h = 0;
+
+    for(size_t i = 0; i < key.size(); i++)
+        h = h*coeff + key[i];
+
+    return h;
+}
+
+//Matches getModulusBitmask() + 1
+constexpr size_t tableSize(size_t count) noexcept{
+    size_t size = 2;
+    while(size < count) size <<= 1;
+    return size;
+}
+
+}
+
+template<size_t N1, size_t N2>
+class Map{
+public:
+    constexpr std::string_view lookup(std::string_view key) const noexcept{
+        const size_t h1 = detail::hash(key, s0) & (N1-1);
+        const size_t bin = detail::hash(key, seeds[h1]) & (N2-1);
+        return keys[bin] == key ? vals[bin] : default_value;
+    }
+
+    constexpr std::string_view lookup(const char* str, size_t size) const noexcept{
+        return lookup(std::string_view(str, size));
+    }
+
+    uint32_t s0 = 0;
+    std::array<uint16_t, N1> seeds {};
+    std::array<std::string_view, N2> keys {};
+    std::array<std::string_view, N2> vals {};
+    std::string_view default_value;
+};
+
+namespace detail{
+
+//Each step counts towards the evaluation budget, so the search works on raw arrays and pointers
+template<size_t N, size_t N1, size_t N2>
+constexpr bool findSeeds(const std::array<std::pair<std::string_view, std::string_view>, N>& entries, Map<N1, N2>& map){
+    uint32_t h1[N] {};
+    uint32_t bin_size[N1] {};
+    for(size_t i = 0; i < N; i++){
+        h1[i] = hash(entries[i].first, map.s0) & (N1-1);
+        if(++bin_size[h1[i]] >= max_keys1) return false;
+    }
+
+    //Key indices counting sorted by layer-1 hash, as in Layer1::order
+    size_t bin_start[N1+1] {};
+    for(size_t h = 0; h < N1; h++) bin_start[h+1] = bin_start[h] + bin_size[h];
+    size_t order[N] {};
+    size_t fill[N1] {};
+    for(size_t i = 0; i < N; i++) order[bin_start[h1[i]] + fill[h1[i]]++] = i;
+
+    bool occupied[N2] {};
+
+    //Place the largest bins first, breaking ties by the highest layer-1 hash as hashSearch2() does
+    for(uint32_t size = max_keys1-1; size > 0; size--){
+        for(size_t h = N1; h-- > 0;){
+            if(bin_size[h] != size) continue;
+
+            const char* members[max_keys1] {};
+            size_t member_sizes[max_keys1] {};
+            for(size_t i = 0; i < size; i++){
+                const std::string_view key = entries[order[bin_start[h]+i]].first;
+                members[i] = key.data();
+                member_sizes[i] = key.size();
+
+                //Equal keys always share a bin, so this finds every duplicate
+                for(size_t j = 0; j < i; j++)
+                    if(key == std::string_view(members[j], member_sizes[j])) throw std::invalid_argument("poifect::make_map: duplicate key");
+            }
+
+            //Slots only depend on the seed modulo N2, so larger seeds repeat earlier ones
+            bool placed = false;
+            for(uint32_t seed = 0; !placed && seed < (N2 < 0xFFFF ? N2 : 0xFFFF); seed++){
+                size_t slots[max_keys1] {};
+                placed = true;
+                for(size_t i = 0; placed && i < size; i++){
+                    uint32_t hash = 0;
+                    for(const char* c = members[i]; c != members[i] + member_sizes[i]; c++) hash = hash*seed + *c;
+                    slots[i] = hash & (N2-1);
+                    if(occupied[slots[i]]){
+                        for(size_t j = 0; j < i; j++) occupied[slots[j]] = false;
+                        placed = false;
+                    }else{
+                        occupied[slots[i]] = true;
+                    }
+                }
+                if(placed) map.seeds[h] = seed;
+            }
+
+            if(!placed) return false;
+        }
+    }
+
+    return true;
+}
+
+}
+
+//Reduction matches the hashSearch2() parameter, with N/Reduction layer-1 bins rounded down before the power of
+//two, as hashSearch2() sizes them
+template<size_t Reduction = 1, size_t N>
+constexpr Map<detail::tableSize(N/Reduction), detail::tableSize(N)> make_map(const std::array<std::pair<std::string_view, std::string_view>, N>& entries,
+                                                                             std::string_view default_value = ""){
+    static_assert(N > 1, "poifect::make_map needs at least two keys");
+    static_assert(Reduction > 0, "poifect::make_map needs a positive reduction");
+
+    Map<detail::tableSize(N/Reduction), detail::tableSize(N)> map;
+    map.default_value = default_value;
+
+    for(const uint8_t& prime : detail::primes){
+        map.s0 = prime;
+        map.seeds = {};
+        if(!detail::findSeeds(entries, map)) continue;
+
+        //Empty slots hold the default value, so a miss on one still returns it
+        for(std::string_view& val : map.vals) val = default_value;
+        for(const auto& entry : entries){
+            const size_t h1 = detail::hash(entry.first, map.s0) & (map.seeds.size()-1);
+            const size_t bin = detail::hash(entry.first, map.seeds[h1]) & (map.keys.size()-1);
+            map.keys[bin] = entry.first;
+            map.vals[bin] = entry.second;
+        }
+
+        return map;
+    }
+
+    throw std::logic_error("poifect::make_map: no seed separates the keys");
+}
+
+namespace detail{
+
+//std::pair assignment isn't constexpr until C++20, so the array is built in one initialization
+template<size_t N, size_t... I>
+constexpr std::array<std::pair<std::string_view, std::string_view>, N> toArray(const std::pair<std::string_view, std::string_view> (&entries)[N],
+                                                                              std::index_sequence<I...>){
+    return {{entries[I]...}};
+}
+
+}
+
+//Takes a built-in array such as a static constexpr table of pairs, deducing N
+template<size_t Reduction = 1, size_t N>
+constexpr auto make_map(const std::pair<std::string_view, std::string_view> (&entries)[N], std::string_view default_value = ""){
+    return make_map<Reduction>(detail::toArray(entries, std::make_index_sequence<N>()), default_value);
+}
+
+}
+
+#endif // HASHCONSTEXPR_H
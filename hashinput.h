@@ -0,0 +1,82 @@
+#ifndef HASHINPUT_H
+#define HASHINPUT_H
+
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+//Key/value rows as typed into the example GUI: one row per line, split into key and value at the first
+//delimiter. Input is read a fixed-size buffer at a time, so beyond the parsed keys and values memory only
+//grows with the longest line.
+
+static bool parseKey(std::string_view text, std::string& key){
+    key.assign(text);
+    return true;
+}
+
+//Integer keys must be a whole unsigned number that fits in KeyType
+template<typename KeyType>
+static bool parseKey(std::string_view text, KeyType& key){
+    const std::from_chars_result result = std::from_chars(text.data(), text.data() + text.size(), key);
+    return result.ec == std::errc() && result.ptr == text.data() + text.size() && !text.empty();
+}
+
+//Appends the rows of in to keys and vals. Lines end in \n or \r\n, and a last line without a newline is still
+//read. Returns false with error set on a line without the delimiter, which includes empty lines, on an integer
+//key that doesn't parse, and on a read error. Line numbers in errors count from the first line read.
+template<typename KeyType>
+bool readRows(std::FILE* in, char delimiter, std::vector<KeyType>& keys, std::vector<std::string>& vals, std::string& error){
+    size_t line = 0;
+    auto row = [&](std::string_view text){
+        line++;
+        if(!text.empty() && text.back() == '\r') text.remove_suffix(1);
+
+        const size_t split = text.find(delimiter);
+        if(split == std::string_view::npos){
+            error = "line " + std::to_string(line) + " does not have a key and value";
+            return false;
+        }
+
+        KeyType key;
+        if(!parseKey(text.substr(0, split), key)){
+            error = "line " + std::to_string(line) + " does not have a valid integer key";
+            return false;
+        }
+
+        keys.push_back(std::move(key));
+        vals.emplace_back(text.substr(split+1));
+        return true;
+    };
+
+    std::vector<char> buffer(1 << 16);
+    std::string partial;
+    for(size_t read; (read = std::fread(buffer.data(), 1, buffer.size(), in)) > 0;){
+        const char* start = buffer.data();
+        const char* const end = start + read;
+
+        //Lines within the buffer are parsed in place, and only one that runs past its end is copied
+        for(const char* newline; (newline = static_cast<const char*>(std::memchr(start, '\n', size_t(end - start))));){
+            if(partial.empty()){
+                if(!row(std::string_view(start, size_t(newline - start)))) return false;
+            }else{
+                partial.append(start, newline);
+                if(!row(partial)) return false;
+                partial.clear();
+            }
+            start = newline + 1;
+        }
+        partial.append(start, end);
+    }
+
+    if(std::ferror(in)){
+        error = "read error after line " + std::to_string(line);
+        return false;
+    }
+
+    return partial.empty() || row(partial);
+}
+
+#endif // HASHINPUT_H
@@ -0,0 +1,393 @@
+#ifndef HASHMAPPED_H
+#define HASHMAPPED_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+#include "hashruntime.h"
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+//A map file holds the tables of a PoifectRuntimeMap for lookups straight from a read-only mapping of the file,
+//so processes sharing a map share one copy of it in the page cache and open it without parsing anything.
+//
+//The file starts with a MappedHeader, followed by the seeds, the slot records, the packed keys, the packed
+//values, the key positions and the partitions, each starting on a mapped_alignment boundary. The records are
+//written as the writing build lays them out, so a file is read by builds of the same key type on the same
+//platform. The endianness tag catches a file moved to a machine with the other byte order, and the checksum
+//catches a damaged or truncated file.
+constexpr uint32_t mapped_version = 2;
+constexpr uint32_t mapped_endianness = 0x01020304;
+constexpr size_t mapped_alignment = 4096;
+
+struct MappedSection{
+    uint64_t offset;
+    uint64_t size;
+};
+
+struct MappedHeader{
+    char magic[8];
+    uint32_t endianness;
+    uint32_t version;
+    uint64_t file_size;
+    uint64_t checksum; //Over the whole file, with this field as 0
+
+    uint32_t key_size;  //sizeof(KeyType), or 0 for string keys
+    uint32_t slot_size; //sizeof(RuntimeKeys<KeyType>::Slot)
+    uint32_t two_layer;
+    uint32_t multiply_shift;
+    uint64_t n;
+    uint64_t n1;
+    uint32_t s0;
+    uint32_t c[6];
+    uint32_t use_size;
+    uint64_t min_size;
+    uint32_t default_start;
+    uint32_t default_size;
+
+    MappedSection seeds;
+    MappedSection slots;
+    MappedSection flat_keys;
+    MappedSection flat_vals;
+    MappedSection positions;
+    MappedSection partitions;
+};
+
+static constexpr char mapped_magic[8] = {'P', 'O', 'I', 'F', 'E', 'C', 'T', '\0'};
+
+//FNV-1a over the 64-bit words of the file, which is padded to whole words, reading the checksum field as 0
+struct MappedChecksum{
+    uint64_t h = 14695981039346656037u;
+    uint64_t offset = 0;
+    char pending[sizeof(uint64_t)];
+    size_t num_pending = 0;
+
+    void update(const char* data, size_t size){
+        for(; size && num_pending; data++, size--){
+            pending[num_pending++] = *data;
+            if(num_pending == sizeof(uint64_t)){
+                fold(pending);
+                num_pending = 0;
+            }
+        }
+
+        for(; size >= sizeof(uint64_t); data += sizeof(uint64_t), size -= sizeof(uint64_t))
+            fold(data);
+
+        for(; size && num_pending < sizeof(uint64_t); data++, size--)
+            pending[num_pending++] = *data;
+    }
+
+    void fold(const char* bytes){
+        uint64_t word = 0;
+        if(offset != offsetof(MappedHeader, checksum)) std::memcpy(&word, bytes, sizeof(word));
+        h = (h ^ word) * 1099511628211u;
+        offset += sizeof(uint64_t);
+    }
+};
+
+//Lookups on a map file. open() maps the file read-only and points into it, so the tables are never copied.
+template<typename KeyType>
+class PoifectMappedMap{
+public:
+    typedef typename RuntimeKeys<KeyType>::Query Query;
+    typedef typename RuntimeKeys<KeyType>::Slot Slot;
+
+    PoifectMappedMap() = default;
+    PoifectMappedMap(const PoifectMappedMap&) = delete;
+    PoifectMappedMap& operator=(const PoifectMappedMap&) = delete;
+
+    ~PoifectMappedMap(){
+        close();
+    }
+
+    //Writes a built map to path. The file is written beside it and renamed into place, so processes that
+    //have the old file mapped keep reading it undisturbed. Windows refuses the rename while the old file is
+    //mapped.
+    static bool write(const PoifectRuntimeMap<KeyType>& map, const std::string& path){
+        if(map.slots.empty()) return false;
+
+        //Zeroed rather than value-initialized so the padding is zero too and the same map writes the same file
+        MappedHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, mapped_magic, sizeof(mapped_magic));
+        header.endianness = mapped_endianness;
+        header.version = mapped_version;
+        header.key_size = std::is_same<KeyType, std::string>::value ? 0 : sizeof(KeyType);
+        header.slot_size = sizeof(Slot);
+        header.two_layer = map.two_layer;
+        header.multiply_shift = map.n.multiply_shift;
+        header.n = map.n.n;
+        header.n1 = map.n1.n;
+        header.s0 = map.s0;
+        std::copy(map.c.begin(), map.c.end(), header.c);
+        header.use_size = map.positions.use_size;
+        header.min_size = map.positions.min_size;
+        header.default_start = map.default_start;
+        header.default_size = map.default_size;
+
+        //The layout is settled first so the header can be checksummed before the sections are streamed out
+        uint64_t end = sizeof(MappedHeader);
+        auto place = [&end](size_t size){
+            end = (end + mapped_alignment - 1) / mapped_alignment * mapped_alignment;
+            const MappedSection section {end, size};
+            end += size;
+            return section;
+        };
+        header.seeds = place(map.seeds.size()*sizeof(SeedType));
+        header.slots = place(map.slots.size()*sizeof(Slot));
+        header.flat_keys = place(map.flat_keys.size());
+        header.flat_vals = place(map.flat_vals.size());
+        header.positions = place(map.positions.positions.size()*sizeof(int));
+        header.partitions = place(map.partitions.size()*sizeof(Partition));
+        header.file_size = (end + sizeof(uint64_t) - 1) / sizeof(uint64_t) * sizeof(uint64_t);
+
+        const std::string temp_path = path + ".tmp";
+        std::FILE* out = std::fopen(temp_path.c_str(), "wb");
+        if(!out) return false;
+
+        MappedChecksum checksum;
+        bool written = true;
+        auto put = [&](const void* data, size_t size){
+            if(!size) return;
+            checksum.update(static_cast<const char*>(data), size);
+            written &= std::fwrite(data, 1, size, out) == size;
+        };
+        auto padTo = [&](uint64_t offset){
+            static constexpr char zeros[mapped_alignment] = {};
+            while(checksum.offset + checksum.num_pending < offset)
+                put(zeros, std::min<uint64_t>(offset - checksum.offset - checksum.num_pending, sizeof(zeros)));
+        };
+
+        put(&header, sizeof(header));
+        padTo(header.seeds.offset);
+        put(map.seeds.data(), header.seeds.size);
+        padTo(header.slots.offset);
+        put(map.slots.data(), header.slots.size);
+        padTo(header.flat_keys.offset);
+        put(map.flat_keys.data(), header.flat_keys.size);
+        padTo(header.flat_vals.offset);
+        put(map.flat_vals.data(), header.flat_vals.size);
+        padTo(header.positions.offset);
+        put(map.positions.positions.data(), header.positions.size);
+        padTo(header.partitions.offset);
+        put(map.partitions.data(), header.partitions.size);
+        padTo(header.file_size);
+
+        header.checksum = checksum.h;
+        written &= std::fseek(out, 0, SEEK_SET) == 0 && std::fwrite(&header, 1, sizeof(header), out) == sizeof(header);
+        if(std::fclose(out) != 0 || !written){
+            std::remove(temp_path.c_str());
+            return false;
+        }
+
+        #if defined(_WIN32)
+        return MoveFileExA(temp_path.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+        #else
+        return std::rename(temp_path.c_str(), path.c_str()) == 0;
+        #endif
+    }
+
+    //Checking the checksum reads the whole file. Skipping it opens a map in time independent of its key count,
+    //with only the header, the section bounds and the partition table checked.
+    bool open(const std::string& path, bool verify_checksum = true){
+        close();
+        if(!map(path)) return false;
+
+        if(!load(verify_checksum)){
+            close();
+            return false;
+        }
+
+        return true;
+    }
+
+    void close(){
+        if(!file_data) return;
+
+        #if defined(_WIN32)
+        UnmapViewOfFile(file_data);
+        #else
+        munmap(const_cast<char*>(file_data), file_size);
+        #endif
+
+        file_data = nullptr;
+        file_size = 0;
+        slots = nullptr;
+        num_slots = 0;
+        partitions = nullptr;
+        num_partitions = 0;
+    }
+
+    std::string_view lookup(const Query& key) const noexcept{
+        if(!num_slots) return std::string_view();
+
+        const Slot& slot = slots[bin(key)];
+        if(!RuntimeKeys<KeyType>::matches(slot, key, flat_keys)) return lookupStash(key);
+
+        return std::string_view(flat_vals + slot.val_start, slot.val_size);
+    }
+
+    //Slots in the final table, including empty ones and the stash
+    size_t size() const{
+        return num_slots;
+    }
+
+private:
+    //Stashed keys' records follow the table's slots and are only scanned when a key's slot doesn't match it
+    std::string_view lookupStash(const Query& key) const noexcept{
+        for(size_t i = n.size(); i < num_slots; i++)
+            if(RuntimeKeys<KeyType>::matches(slots[i], key, flat_keys)) return std::string_view(flat_vals + slots[i].val_start, slots[i].val_size);
+
+        return std::string_view(flat_vals + default_start, default_size);
+    }
+
+    bool map(const std::string& path){
+        #if defined(_WIN32)
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if(file == INVALID_HANDLE_VALUE) return false;
+
+        LARGE_INTEGER length;
+        HANDLE mapping = nullptr;
+        if(GetFileSizeEx(file, &length) && length.QuadPart >= LONGLONG(sizeof(MappedHeader)))
+            mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        CloseHandle(file);
+        if(!mapping) return false;
+
+        void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(mapping);
+        if(!view) return false;
+
+        file_data = static_cast<const char*>(view);
+        file_size = size_t(length.QuadPart);
+        #else
+        const int file = ::open(path.c_str(), O_RDONLY);
+        if(file == -1) return false;
+
+        struct stat info;
+        void* view = MAP_FAILED;
+        if(fstat(file, &info) == 0 && size_t(info.st_size) >= sizeof(MappedHeader))
+            view = mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_SHARED, file, 0);
+        ::close(file);
+        if(view == MAP_FAILED) return false;
+
+        file_data = static_cast<const char*>(view);
+        file_size = size_t(info.st_size);
+        #endif
+
+        return true;
+    }
+
+    bool load(bool verify_checksum){
+        MappedHeader header;
+        std::memcpy(&header, file_data, sizeof(header));
+
+        if(std::memcmp(header.magic, mapped_magic, sizeof(mapped_magic)) != 0) return false;
+        if(header.endianness != mapped_endianness) return false;
+        if(header.version != mapped_version) return false;
+        if(header.file_size != file_size || file_size % sizeof(uint64_t) != 0) return false;
+        if(header.key_size != (std::is_same<KeyType, std::string>::value ? 0 : sizeof(KeyType))) return false;
+        if(header.slot_size != sizeof(Slot)) return false;
+        if(verify_checksum){
+            MappedChecksum checksum;
+            checksum.update(file_data, file_size);
+            if(header.checksum != checksum.h) return false;
+        }
+
+        for(const MappedSection& section : {header.seeds, header.slots, header.flat_keys, header.flat_vals, header.positions, header.partitions})
+            if(section.offset % mapped_alignment != 0 || section.offset > file_size || section.size > file_size - section.offset) return false;
+
+        n = SlotRange{size_t(header.n), header.multiply_shift != 0};
+        n1 = SlotRange{size_t(header.n1), header.multiply_shift != 0};
+        if(header.slots.size % sizeof(Slot) != 0 || header.slots.size < n.size()*sizeof(Slot)) return false;
+        if(header.two_layer && header.seeds.size != n1.size()*sizeof(SeedType)) return false;
+        if(uint64_t(header.default_start) + header.default_size > header.flat_vals.size) return false;
+
+        two_layer = header.two_layer != 0;
+        s0 = SeedType(header.s0);
+        std::copy(header.c, header.c + c.size(), c.begin());
+        default_start = header.default_start;
+        default_size = header.default_size;
+
+        //The positions are a few ints, copied so that the engines' hash functions can take them
+        positions.positions.resize(header.positions.size / sizeof(int));
+        if(!positions.positions.empty())
+            std::memcpy(positions.positions.data(), file_data + header.positions.offset, positions.positions.size()*sizeof(int));
+        positions.use_size = header.use_size != 0;
+        positions.min_size = size_t(header.min_size);
+
+        partitions = reinterpret_cast<const Partition*>(file_data + header.partitions.offset);
+        num_partitions = header.partitions.size / sizeof(Partition);
+        if(header.partitions.size % sizeof(Partition) != 0 || (num_partitions && !checkPartitions())) return false;
+        if(num_partitions) partition_range = partitionRange(num_partitions-1);
+
+        seeds = reinterpret_cast<const SeedType*>(file_data + header.seeds.offset);
+        slots = reinterpret_cast<const Slot*>(file_data + header.slots.offset);
+        flat_keys = file_data + header.flat_keys.offset;
+        flat_vals = file_data + header.flat_vals.offset;
+        num_slots = header.slots.size / sizeof(Slot);
+
+        return true;
+    }
+
+    //Every partition's runs of seeds and slots must be non-empty and lie within the tables, so that lookups
+    //stay in bounds even when the checksum isn't checked
+    bool checkPartitions() const{
+        if(!two_layer || num_partitions < 2) return false;
+        if(partitions[0].seed_start != 0 || partitions[0].slot_start != 0) return false;
+
+        for(size_t p = 1; p < num_partitions; p++)
+            if(partitions[p].seed_start <= partitions[p-1].seed_start || partitions[p].slot_start <= partitions[p-1].slot_start) return false;
+
+        return partitions[num_partitions-1].seed_start == n1.size() && partitions[num_partitions-1].slot_start == n.size();
+    }
+
+    size_t bin(const Query& key) const{
+        if(!two_layer) return n(RuntimeKeys<KeyType>::hash1(key, c, positions));
+        if(num_partitions){
+            return partitionedBin(partitions, partition_range, seeds, n.multiply_shift,
+                                  [&](SeedType coeff){ return RuntimeKeys<KeyType>::hash2(key, coeff, positions); });
+        }
+
+        const size_t h1 = n1(RuntimeKeys<KeyType>::hash2(key, s0, positions));
+        return n(RuntimeKeys<KeyType>::hash2(key, seeds[h1], positions));
+    }
+
+    const char* file_data = nullptr;
+    size_t file_size = 0;
+
+    bool two_layer = false;
+    SlotRange n {};
+    SlotRange n1 {};
+    Coeffs c {};
+    SeedType s0 = 0;
+    KeyPositions positions;
+
+    const SeedType* seeds = nullptr;
+    const Partition* partitions = nullptr;
+    size_t num_partitions = 0;
+    SlotRange partition_range {};
+    const Slot* slots = nullptr;
+    size_t num_slots = 0;
+    const char* flat_keys = nullptr;
+    const char* flat_vals = nullptr;
+    uint32_t default_start = 0;
+    uint32_t default_size = 0;
+};
+
+#endif // HASHMAPPED_H
@@ -0,0 +1,191 @@
+#ifndef HASHOPTIONS_H
+#define HASHOPTIONS_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+//The options, progress and statistics of a search. This header only declares types, so a header shared by
+//several translation units, such as the example's window, can hold them without hashutil.h's functions.
+
+//Shared with a search running on another thread. The search adds to the counters as it goes, and gives up,
+//returning false, soon after cancel is set.
+struct SearchProgress{
+    std::atomic<bool> cancel {false};
+    std::atomic<uint64_t> candidates {0};  //hashSearch() coefficient sets checked, hashSearch2() top-level seeds tried
+    std::atomic<uint64_t> bins_placed {0}; //hashSearch2() layer-1 bins given a seed
+
+    bool cancelled() const{
+        return cancel.load(std::memory_order_relaxed);
+    }
+
+    void reset(){
+        cancel = false;
+        candidates = 0;
+        bins_placed = 0;
+    }
+};
+
+struct SearchOptions{
+    //Worker threads used by the search, 0 for one per hardware thread
+    unsigned num_threads = 1;
+
+    //Visit hashSearch() candidates cheapest first and stop at the first collision-free one
+    bool cost_ordered = false;
+
+    //Store hashSearch2() seeds bit-packed or dictionary coded when that is smaller than a uint8_t/uint16_t array
+    bool compact_seeds = false;
+
+    //Interleave the per-slot key and value metadata into one record instead of one array per field
+    bool interleave_slots = false;
+
+    //Reduce hashes onto tables of any size with a multiply-shift instead of rounding up to a power of two
+    bool multiply_shift = false;
+
+    //Keys per final-table slot. 1.0 with multiply_shift gives a minimal perfect hash.
+    double load_factor = 1.0;
+
+    //Hash string keys on a selected set of character positions and the length instead of every character
+    bool key_positions = false;
+
+    //Split hashSearch2() keys by a top-level hash into partitions of about this many keys, each searched on its
+    //own and in parallel, at the cost of one more table read per lookup. 0 searches one table over all keys.
+    size_t partition_size = 0;
+
+    //Let a search leave up to this many keys out of the table when no hash places them all. They are stored in a
+    //stash after the table's slots, which lookups scan only when the query's own slot holds another key.
+    size_t stash_size = 0;
+
+    //Progress reporting and cancellation for a search on another thread, or nullptr
+    SearchProgress* progress = nullptr;
+};
+
+//What a search did, to tune expansion and reduction by. findHash() and findHash2() fill it whether or not they
+//find a hash, and hashSearch()/hashSearch2() add the time spent generating code and the size of its tables.
+struct SearchStats{
+    uint8_t engine = 0;
+    size_t num_keys = 0;
+    size_t layer1_bins = 0;    //hashSearch2() only
+    size_t final_slots = 0;
+    size_t num_partitions = 0; //0 unless partitioned
+
+    //hashSearch(): coefficient candidates checked for collisions. hashSearch2(): top-level seeds tried, over
+    //every partition.
+    uint64_t candidates = 0;
+
+    //hashSearch2() top-level seeds given up on: for layer-1 bins of max_keys1 keys or more (and how many such
+    //bins they had), for a bin no seed placed, and for a lower seed having succeeded first
+    uint64_t oversized_trials = 0;
+    uint64_t oversized_bins = 0;
+    uint64_t exhausted_trials = 0;
+    uint64_t cancelled_trials = 0;
+    uint64_t retried_partitions = 0;
+    uint32_t s0 = 0; //The top-level seed found, unless partitioned
+    uint64_t stashed_keys = 0; //Keys left out of the table, through SearchOptions::stash_size
+
+    //hashSearch2() with a stash that no trial fit in: the smallest stash_size a search would succeed with,
+    //or 0 if no trial got far enough to tell
+    uint64_t needed_stash = 0;
+    bool cancelled = false; //Through SearchOptions::progress
+
+    //rebuildHash2(): the layer-1 bins seeded again because they gained keys, the bins evicted to make room for
+    //them, and the partitions that couldn't be rebuilt and were searched again
+    bool rebuilt = false;
+    uint64_t reseeded_bins = 0;
+    uint64_t evicted_bins = 0;
+    uint64_t researched_partitions = 0;
+
+    //hashSearch2(), indexed by bin size: bins placed and seeds tested over every trial, and the layer-1 bin
+    //sizes of the tables found
+    std::vector<uint64_t> bins_placed;
+    std::vector<uint64_t> seeds_tried;
+    std::vector<uint64_t> bin_sizes;
+
+    double positions_seconds = 0;
+    double search_seconds = 0;
+    double generate_seconds = 0;
+
+    size_t table_bytes = 0; //Generated tables in a release build
+
+    static void addCounts(std::vector<uint64_t>& counts, const std::vector<uint64_t>& other){
+        if(counts.size() < other.size()) counts.resize(other.size(), 0);
+        for(size_t i = 0; i < other.size(); i++) counts[i] += other[i];
+    }
+
+    void needStash(uint64_t stash_size){
+        if(!needed_stash || stash_size < needed_stash) needed_stash = stash_size;
+    }
+
+    //Adds the counters of a search over other keys, such as a partition or a worker's share of the trials.
+    //The needed stash is the smallest of the two, as for trials of the same keys.
+    void merge(const SearchStats& other){
+        if(other.needed_stash) needStash(other.needed_stash);
+        candidates += other.candidates;
+        oversized_trials += other.oversized_trials;
+        oversized_bins += other.oversized_bins;
+        exhausted_trials += other.exhausted_trials;
+        cancelled_trials += other.cancelled_trials;
+        retried_partitions += other.retried_partitions;
+        reseeded_bins += other.reseeded_bins;
+        evicted_bins += other.evicted_bins;
+        researched_partitions += other.researched_partitions;
+        addCounts(bins_placed, other.bins_placed);
+        addCounts(seeds_tried, other.seeds_tried);
+        addCounts(bin_sizes, other.bin_sizes);
+    }
+
+    static std::string countsStr(const std::vector<uint64_t>& counts){
+        std::string str;
+        for(size_t i = 0; i < counts.size(); i++)
+            if(counts[i]) str += " " + std::to_string(i) + ":" + std::to_string(counts[i]);
+        return str.empty() ? " none" : str;
+    }
+
+    //A few lines for a log or status bar
+    std::string summary() const{
+        char buffer[160];
+        std::string str = "engine " + std::to_string(engine) + ", " + std::to_string(num_keys) + " keys, ";
+        if(engine == 2) str += std::to_string(layer1_bins) + " layer-1 bins, ";
+        str += std::to_string(final_slots) + " slots";
+        if(num_partitions) str += " in " + std::to_string(num_partitions) + " partitions";
+        if(stashed_keys) str += ", " + std::to_string(stashed_keys) + " keys stashed";
+        if(needed_stash) str += ", needs a stash of " + std::to_string(needed_stash);
+        if(cancelled) str += ", cancelled";
+        str += "\n";
+
+        if(engine == 1){
+            str += std::to_string(candidates) + " coefficient candidates checked\n";
+        }else{
+            str += std::to_string(candidates) + " top-level seeds tried";
+            if(!num_partitions && !bin_sizes.empty()) str += ", found s0 = " + std::to_string(s0);
+            str += "; rejected " + std::to_string(oversized_trials) + " for oversized bins (" + std::to_string(oversized_bins)
+                   + " bins), " + std::to_string(exhausted_trials)
+                   + " for a bin out of seeds, " + std::to_string(cancelled_trials) + " cancelled";
+            if(num_partitions) str += ", " + std::to_string(retried_partitions) + " partitions retried";
+            str += "\n";
+            if(rebuilt){
+                str += "rebuilt on the previous tables: " + std::to_string(reseeded_bins) + " bins seeded again, "
+                       + std::to_string(evicted_bins) + " evicted";
+                if(num_partitions) str += ", " + std::to_string(researched_partitions) + " partitions searched again";
+                str += "\n";
+            }
+            str += "layer-1 bin sizes:" + countsStr(bin_sizes) + "\n";
+            str += "seeds tried by bin size:" + countsStr(seeds_tried) + "\n";
+        }
+
+        std::snprintf(buffer, sizeof(buffer), "positions %.3fs, search %.3fs, generate %.3fs",
+                      positions_seconds, search_seconds, generate_seconds);
+        str += buffer;
+        if(table_bytes){
+            std::snprintf(buffer, sizeof(buffer), "; tables %zu bytes, %.2f bytes per key", table_bytes, table_bytes / double(num_keys));
+            str += buffer;
+        }
+
+        return str;
+    }
+};
+
+#endif // HASHOPTIONS_H
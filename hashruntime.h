@@ -0,0 +1,524 @@
+#ifndef HASHRUNTIME_H
+#define HASHRUNTIME_H
+
+#include <cassert>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "hashsearch.h"
+#include "hashsearch2.h"
+
+//The stored key of each slot and the hashes of a query. Integer keys are stored in the slot records, with
+//empty slots holding 0 as in the generated keys array.
+template<typename KeyType>
+struct RuntimeKeys{
+    typedef KeyType Query;
+
+    struct Slot{
+        KeyType key;
+        uint32_t val_start;
+        uint32_t val_size;
+    };
+
+    static void assign(const std::vector<KeyType>& keys, const std::vector<int>& mapping, std::vector<Slot>& slots, std::string&){
+        for(size_t i = 0; i < mapping.size(); i++)
+            slots[i].key = mapping[i] == -1 ? KeyType() : keys[mapping[i]];
+    }
+
+    static bool matches(const Slot& slot, const Query& key, const char*){
+        return slot.key == key;
+    }
+
+    static void set(Slot& slot, const KeyType& key, std::string&){
+        slot.key = key;
+    }
+
+    static KeyType key(const Slot& slot, const std::string&){
+        return slot.key;
+    }
+
+    static uint32_t hash1(const Query& key, const Coeffs& c, const KeyPositions&){
+        return hash(uint32_t(key), c);
+    }
+
+    static uint32_t hash2(const Query& key, const SeedType& coeff, const KeyPositions&){
+        return ::hash2(size_t(key), coeff);
+    }
+};
+
+//String keys are packed into one character array, which the slot records index as in the generated flat_keys
+template<>
+struct RuntimeKeys<std::string>{
+    typedef std::string_view Query;
+
+    struct Slot{
+        uint32_t key_start;
+        uint32_t key_size;
+        uint32_t val_start;
+        uint32_t val_size;
+    };
+
+    static void assign(const std::vector<std::string>& keys, const std::vector<int>& mapping, std::vector<Slot>& slots, std::string& flat_keys){
+        const std::string empty;
+        flat_keys.clear();
+        for(size_t i = 0; i < mapping.size(); i++){
+            const std::string& key = mapping[i] == -1 ? empty : keys[mapping[i]];
+            slots[i].key_start = uint32_t(flat_keys.size());
+            slots[i].key_size = uint32_t(key.size());
+            flat_keys += key;
+        }
+    }
+
+    static bool matches(const Slot& slot, std::string_view key, const char* flat_keys){
+        if(slot.key_size != key.size()) return false;
+        return key.empty() || std::memcmp(key.data(), &flat_keys[slot.key_start], key.size()) == 0;
+    }
+
+    //Appends the key to flat_keys, whose earlier keys stay where they are
+    static void set(Slot& slot, const std::string& key, std::string& flat_keys){
+        slot.key_start = uint32_t(flat_keys.size());
+        slot.key_size = uint32_t(key.size());
+        flat_keys += key;
+        assert(flat_keys.size() <= std::numeric_limits<uint32_t>::max());
+    }
+
+    static std::string key(const Slot& slot, const std::string& flat_keys){
+        return flat_keys.substr(slot.key_start, slot.key_size);
+    }
+
+    static uint32_t hash1(std::string_view key, const Coeffs& c, const KeyPositions& positions){
+        return hash(key.data(), key.size(), c, positions);
+    }
+
+    static uint32_t hash2(std::string_view key, const SeedType& coeff, const KeyPositions& positions){
+        return ::hash2(key.data(), key.size(), coeff, positions);
+    }
+};
+
+//The final slot of a key in a partitioned map. hash(coeff) hashes the key as the search did.
+template<typename Hash>
+static size_t partitionedBin(const Partition* partitions, const SlotRange& partition_range, const SeedType* seeds, bool multiply_shift, const Hash& hash){
+    const Partition* part = &partitions[partition_range(hash(partition_seed))];
+    const SlotRange n1 {part[1].seed_start - part->seed_start - 1, multiply_shift};
+    const SlotRange n2 {part[1].slot_start - part->slot_start - 1, multiply_shift};
+
+    const size_t h1 = part->seed_start + n1(hash(SeedType(part->s0)));
+    return part->slot_start + n2(hash(seeds[h1]));
+}
+
+//A map built when the program runs, for key sets that are only known at startup. build() runs the same
+//search as hashSearch() or hashSearch2() and keeps the tables the generated header would hold in memory,
+//so lookups return what the generated lookup() would, and no source is ever written. Lookups always check
+//the stored key. The slot records are always interleaved and the seeds kept as uint16_t, so the
+//compact_seeds and interleave_slots options have no effect. Stashed keys get slot records after the table's.
+template<typename KeyType>
+class PoifectMappedMap;
+
+template<typename KeyType>
+class PoifectRuntimeMap{
+    friend class PoifectMappedMap<KeyType>;
+
+public:
+    typedef typename RuntimeKeys<KeyType>::Query Query;
+
+    //Returns false, leaving the map empty, if the keys hold duplicates or the search finds no hash. stats gets
+    //what the search did, if it ran.
+    bool build(const std::vector<KeyType>& keys,
+               const std::vector<std::string>& vals,
+               std::string default_value = "",
+               uint8_t engine = 2,
+               uint8_t expansion = 1,
+               uint8_t reduction = 1,
+               const SearchOptions& options = SearchOptions(),
+               SearchStats* stats = nullptr){
+        assert(vals.size() == keys.size());
+        assert(engine == 1 || engine == 2);
+        clear();
+        if(keys.size() < 2 || hasDuplicates(keys)) return false;
+
+        std::vector<int> mapping;
+        if(!search(keys, engine, expansion, reduction, options, stats, mapping)) return false;
+        fill(keys, vals, mapping, default_value);
+
+        return true;
+    }
+
+    //Takes the tables findHash() or findHash2() found for these keys instead of searching, for callers that
+    //also generate a header from them
+    bool build(const std::vector<KeyType>& keys,
+               const std::vector<std::string>& vals,
+               const SearchResult& result,
+               std::string default_value = ""){
+        assert(vals.size() == keys.size());
+        clear();
+        if(keys.size() < 2 || hasDuplicates(keys)) return false;
+
+        std::vector<int> mapping;
+        take(result, mapping);
+        fill(keys, vals, mapping, default_value);
+
+        return true;
+    }
+
+    bool build(const std::vector<KeyType>& keys,
+               const std::vector<std::string>& vals,
+               const SearchResult2& result,
+               std::string default_value = ""){
+        assert(vals.size() == keys.size());
+        clear();
+        if(keys.size() < 2 || hasDuplicates(keys)) return false;
+
+        std::vector<int> mapping;
+        take(result, mapping);
+        fill(keys, vals, mapping, default_value);
+
+        return true;
+    }
+
+    std::string_view lookup(const Query& key) const noexcept{
+        if(slots.empty()) return std::string_view();
+
+        const typename RuntimeKeys<KeyType>::Slot& slot = slots[bin(key)];
+        if(!RuntimeKeys<KeyType>::matches(slot, key, flat_keys.data())) return lookupStash(key);
+
+        return std::string_view(flat_vals.data() + slot.val_start, slot.val_size);
+    }
+
+    //Slots in the final table, including empty ones and the stash
+    size_t size() const{
+        return slots.size();
+    }
+
+    void clear(){
+        slots.clear();
+        seeds.clear();
+        partitions.clear();
+        flat_keys.clear();
+        flat_vals.clear();
+    }
+
+protected:
+    //Runs the search and takes its hash, setting mapping to the key index of each final slot or -1
+    bool search(const std::vector<KeyType>& keys,
+                uint8_t engine,
+                uint8_t expansion,
+                uint8_t reduction,
+                const SearchOptions& options,
+                SearchStats* stats,
+                std::vector<int>& mapping){
+        if(engine == 1){
+            SearchResult result;
+            const bool found = findHash(keys, expansion, reduction, options, result);
+            if(stats) *stats = result.stats;
+            if(!found) return false;
+            take(result, mapping);
+        }else{
+            SearchResult2 result;
+            const bool found = findHash2(keys, expansion, reduction, options, result);
+            if(stats) *stats = result.stats;
+            if(!found) return false;
+            take(result, mapping);
+        }
+
+        return true;
+    }
+
+    //Takes the hash of a search result, setting mapping as search() does
+    void take(const SearchResult& result, std::vector<int>& mapping){
+        two_layer = false;
+        n = result.n;
+        c = result.c;
+        positions = result.positions;
+        mapping = stashedMapping(result.mapping, result.stash);
+    }
+
+    void take(const SearchResult2& result, std::vector<int>& mapping){
+        two_layer = true;
+        n = result.n2;
+        n1 = result.n1;
+        s0 = result.s0;
+        positions = result.positions;
+        for(const Bin& bin : result.layer1.bins) seeds.push_back(bin.seed);
+        mapping = stashedMapping(result.mapping, result.stash);
+        partitions = result.partitions;
+        if(!partitions.empty()) partition_range = partitionRange(partitions.size()-1);
+    }
+
+    size_t bin(const Query& key) const{
+        if(!two_layer) return n(RuntimeKeys<KeyType>::hash1(key, c, positions));
+        if(!partitions.empty()){
+            return partitionedBin(partitions.data(), partition_range, seeds.data(), n.multiply_shift,
+                                  [&](SeedType coeff){ return RuntimeKeys<KeyType>::hash2(key, coeff, positions); });
+        }
+
+        const size_t h1 = n1(RuntimeKeys<KeyType>::hash2(key, s0, positions));
+        return n(RuntimeKeys<KeyType>::hash2(key, seeds[h1], positions));
+    }
+
+    //The slots past the table's hold the stashed keys, if any
+    std::string_view lookupStash(const Query& key) const noexcept{
+        for(size_t i = n.size(); i < slots.size(); i++)
+            if(RuntimeKeys<KeyType>::matches(slots[i], key, flat_keys.data())) return std::string_view(flat_vals.data() + slots[i].val_start, slots[i].val_size);
+
+        return std::string_view(flat_vals.data() + default_start, default_size);
+    }
+
+    //Values are packed like flat_vals, with the default value last so that empty slots point at it
+    void fill(const std::vector<KeyType>& keys, const std::vector<std::string>& vals, const std::vector<int>& mapping, const std::string& default_value){
+        std::vector<uint32_t> val_start;
+        for(const std::string& val : vals){
+            val_start.push_back(uint32_t(flat_vals.size()));
+            flat_vals += val;
+        }
+        default_start = uint32_t(flat_vals.size());
+        default_size = uint32_t(default_value.size());
+        flat_vals += default_value;
+        assert(flat_vals.size() <= std::numeric_limits<uint32_t>::max());
+
+        slots.resize(mapping.size());
+        RuntimeKeys<KeyType>::assign(keys, mapping, slots, flat_keys);
+        for(size_t i = 0; i < mapping.size(); i++){
+            slots[i].val_start = mapping[i] == -1 ? default_start : val_start[mapping[i]];
+            slots[i].val_size = mapping[i] == -1 ? default_size : uint32_t(vals[mapping[i]].size());
+        }
+    }
+
+    bool two_layer = false;
+    SlotRange n {};
+    KeyPositions positions;
+
+    //hashSearch() coefficients
+    Coeffs c {};
+
+    //hashSearch2() seeds
+    SlotRange n1 {};
+    SeedType s0 = 0;
+    std::vector<SeedType> seeds;
+    std::vector<Partition> partitions;
+    SlotRange partition_range {};
+
+    std::vector<typename RuntimeKeys<KeyType>::Slot> slots;
+    std::string flat_keys;
+    std::string flat_vals;
+    uint32_t default_start = 0;
+    uint32_t default_size = 0;
+};
+
+//A hashSearch2() runtime map that takes new keys between builds. Its final layer is built with a share of
+//spare slots, and an insert re-seeds only the new key's layer-1 bin around the other keys, so it costs at most
+//a bin's keys hashed over every seed rather than a search. Only when no seed places the bin, or the bin would
+//get max_keys1 keys, is the map built again on every key, with the spare slots restored. Lookups are those
+//of PoifectRuntimeMap and run over the same tables, so they are no slower.
+template<typename KeyType>
+class PoifectUpdatableMap : public PoifectRuntimeMap<KeyType>{
+    typedef PoifectRuntimeMap<KeyType> Base;
+    typedef typename RuntimeKeys<KeyType>::Slot Slot;
+
+public:
+    typedef typename Base::Query Query;
+
+    //As PoifectRuntimeMap::build() with engine 2, leaving about spare of the final slots empty for inserts
+    bool build(const std::vector<KeyType>& keys,
+               const std::vector<std::string>& vals,
+               std::string default_value = "",
+               double spare = 0.25,
+               uint8_t expansion = 1,
+               uint8_t reduction = 1,
+               const SearchOptions& options = SearchOptions(),
+               SearchStats* stats = nullptr){
+        assert(vals.size() == keys.size());
+        assert(spare >= 0 && spare < 1);
+        clear();
+        if(keys.size() < 2 || hasDuplicates(keys)) return false;
+
+        //Stashed keys aren't in their bins, so the stash is left off
+        SearchOptions sized = options;
+        sized.load_factor *= 1.0 - spare;
+        sized.stash_size = 0;
+        std::vector<int> mapping;
+        if(!this->search(keys, 2, expansion, reduction, sized, stats, mapping)) return false;
+        this->fill(keys, vals, mapping, default_value);
+
+        this->spare = spare;
+        this->expansion = expansion;
+        this->reduction = reduction;
+        this->options = options;
+        this->options.progress = nullptr;
+
+        //Each bin's keys are chained through their slots, so an insert finds them without a search
+        occupied.resize(mapping.size());
+        next.assign(mapping.size(), none);
+        first.assign(this->seeds.size(), none);
+        for(size_t slot = 0; slot < mapping.size(); slot++){
+            occupied[slot] = mapping[slot] != -1;
+            if(mapping[slot] == -1) continue;
+
+            const Layer layer = locate(keys[mapping[slot]]);
+            next[slot] = first[layer.h1];
+            first[layer.h1] = uint32_t(slot);
+        }
+
+        return true;
+    }
+
+    //Adds key with val. Returns false, leaving the map as it was, if the map is empty or already holds key, or
+    //if a needed build finds no hash. stats gets what the insert did: the seeds tried on the key's bin, or the
+    //search of a build.
+    bool insert(const KeyType& key, const std::string& val, SearchStats* stats = nullptr){
+        if(this->slots.empty()) return false;
+        const size_t at = this->bin(key);
+        if(occupied[at] && RuntimeKeys<KeyType>::matches(this->slots[at], key, this->flat_keys.data())) return false;
+
+        const Layer layer = locate(key);
+        SearchStats bin_stats;
+        bin_stats.engine = 2;
+        bin_stats.seeds_tried.assign(max_keys1, 0);
+        bin_stats.bins_placed.assign(max_keys1, 0);
+
+        //The bin's seed usually leaves the key a free slot already
+        const size_t slot = layer.slot_start + layer.n2(RuntimeKeys<KeyType>::hash2(key, this->seeds[layer.h1], this->positions));
+        std::vector<uint32_t> bin_slots;
+        for(uint32_t s = first[layer.h1]; s != none; s = next[s]) bin_slots.push_back(s);
+
+        if(bin_slots.size()+1 >= max_keys1) return rebuild(key, val, stats);
+        if(!occupied[slot]){
+            place(slot, key, val, layer.h1);
+            if(stats) *stats = bin_stats;
+            return true;
+        }
+
+        //Otherwise the bin is seeded again with its slots freed, as a search places it
+        std::vector<KeyType> bin_keys;
+        for(const uint32_t& s : bin_slots){
+            bin_keys.push_back(RuntimeKeys<KeyType>::key(this->slots[s], this->flat_keys));
+            occupied[s] = false;
+        }
+        bin_keys.push_back(key);
+
+        Layer1 layer1;
+        for(uint32_t i = 0; i < bin_keys.size(); i++) layer1.order.push_back(i);
+        Bin bin {0, uint32_t(bin_keys.size()), 0};
+        const KeyRefs<KeyType> refs {bin_keys, this->positions};
+        FinalSlots final_layer {occupied, layer.slot_start};
+        const std::atomic<size_t> lowest_success(std::numeric_limits<size_t>::max());
+        const SeedTrial trial {lowest_success, 0, nullptr};
+        bin_stats.reseeded_bins++;
+        if(!findSeed(refs, layer1, bin, layer.n2, final_layer, trial, bin_stats)){
+            for(const uint32_t& s : bin_slots) occupied[s] = true;
+            return rebuild(key, val, stats);
+        }
+
+        //findSeed() marked the new slots, which the bin's records move to
+        std::vector<Slot> records;
+        for(const uint32_t& s : bin_slots){
+            records.push_back(this->slots[s]);
+            empty(s);
+        }
+        first[layer.h1] = none;
+        for(size_t i = 0; i < records.size(); i++){
+            const size_t to = layer.slot_start + layer.n2(refs.hash(i, bin.seed));
+            this->slots[to] = records[i];
+            link(to, layer.h1);
+        }
+        this->seeds[layer.h1] = bin.seed;
+        place(layer.slot_start + layer.n2(refs.hash(records.size(), bin.seed)), key, val, layer.h1);
+        if(stats) *stats = bin_stats;
+
+        return true;
+    }
+
+    void clear(){
+        Base::clear();
+        occupied.clear();
+        first.clear();
+        next.clear();
+    }
+
+private:
+    static constexpr uint32_t none = std::numeric_limits<uint32_t>::max();
+
+    //The layer-1 bin of a key, and the run of final slots its seed reduces onto
+    struct Layer{
+        size_t h1;
+        size_t slot_start;
+        SlotRange n2;
+    };
+
+    Layer locate(const Query& key) const{
+        auto hash = [&](SeedType coeff){ return RuntimeKeys<KeyType>::hash2(key, coeff, this->positions); };
+        if(this->partitions.empty()) return Layer{this->n1(hash(this->s0)), 0, this->n};
+
+        const Partition* part = &this->partitions[this->partition_range(hash(partition_seed))];
+        const SlotRange n1 {part[1].seed_start - part->seed_start - 1, this->n.multiply_shift};
+        const SlotRange n2 {part[1].slot_start - part->slot_start - 1, this->n.multiply_shift};
+
+        return Layer{part->seed_start + n1(hash(SeedType(part->s0))), part->slot_start, n2};
+    }
+
+    //A partition's run of the final slots, as findSeed() indexes them
+    struct FinalSlots{
+        std::vector<bool>& occupied;
+        size_t start;
+
+        std::vector<bool>::reference operator[](size_t slot){
+            return occupied[start + slot];
+        }
+    };
+
+    void link(size_t slot, size_t h1){
+        occupied[slot] = true;
+        next[slot] = first[h1];
+        first[h1] = uint32_t(slot);
+    }
+
+    //Values are appended past the default value, which the slot records point at wherever it is
+    void place(size_t slot, const KeyType& key, const std::string& val, size_t h1){
+        Slot& record = this->slots[slot];
+        RuntimeKeys<KeyType>::set(record, key, this->flat_keys);
+        record.val_start = uint32_t(this->flat_vals.size());
+        record.val_size = uint32_t(val.size());
+        this->flat_vals += val;
+        assert(this->flat_vals.size() <= std::numeric_limits<uint32_t>::max());
+        link(slot, h1);
+    }
+
+    void empty(size_t slot){
+        Slot& record = this->slots[slot];
+        RuntimeKeys<KeyType>::set(record, KeyType(), this->flat_keys);
+        record.val_start = this->default_start;
+        record.val_size = this->default_size;
+        occupied[slot] = false;
+        next[slot] = none;
+    }
+
+    //Builds the map again on its keys and the new one, sized for them with the same share of spare slots
+    bool rebuild(const KeyType& key, const std::string& val, SearchStats* stats){
+        std::vector<KeyType> keys;
+        std::vector<std::string> vals;
+        for(size_t slot = 0; slot < this->slots.size(); slot++){
+            if(!occupied[slot]) continue;
+            keys.push_back(RuntimeKeys<KeyType>::key(this->slots[slot], this->flat_keys));
+            vals.push_back(this->flat_vals.substr(this->slots[slot].val_start, this->slots[slot].val_size));
+        }
+        keys.push_back(key);
+        vals.push_back(val);
+
+        PoifectUpdatableMap rebuilt;
+        if(!rebuilt.build(keys, vals, this->flat_vals.substr(this->default_start, this->default_size), spare, expansion, reduction, options, stats)) return false;
+        *this = std::move(rebuilt);
+
+        return true;
+    }
+
+    double spare = 0.25;
+    uint8_t expansion = 1;
+    uint8_t reduction = 1;
+    SearchOptions options;
+
+    std::vector<bool> occupied;
+    std::vector<uint32_t> first; //The first slot of each bin's keys
+    std::vector<uint32_t> next;  //The next slot of the same bin, by slot
+};
+
+#endif // HASHRUNTIME_H
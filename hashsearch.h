@@ -3,17 +3,22 @@
 
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <cassert>
 #include <limits>
 #include <string>
+#include <unordered_map>
 #include <vector>
+#include "hashsimd.h"
 #include "hashutil.h"
 
-std::array<uint32_t, 6> c;
-std::array<uint32_t, 6> c_min {0, 0, 0, 0, 0, 0};
-std::array<uint32_t, 6> c_max {7, 7, 7, 7, 7, 7};
+typedef std::array<uint32_t, 6> Coeffs;
 
-static uint8_t checkNonzeroCoeffs(){
+Coeffs c;
+Coeffs c_min {0, 0, 0, 0, 0, 0};
+Coeffs c_max {7, 7, 7, 7, 7, 7};
+
+static uint8_t checkNonzeroCoeffs(const Coeffs& c){
     uint8_t active_coeffs = 0;
     for(size_t i = c.size()-1; i < std::numeric_limits<size_t>::max(); i--)
         active_coeffs += c[i]!=0;
@@ -21,7 +26,7 @@ static uint8_t checkNonzeroCoeffs(){
     return active_coeffs;
 }
 
-static uint32_t hash(uint32_t a){
+static uint32_t hash(uint32_t a, const Coeffs& c){
     a =  (a ^ c[0]) ^ (a >> c[1]);
     a += (a << c[2])*(c[2]!=0);
     a ^= (a >> c[3])*(c[3]!=0);
@@ -30,15 +35,47 @@ static uint32_t hash(uint32_t a){
     return a;
 }
 
-static uint32_t hash(const std::string& key){
+//The values the generated string hash xors together: every character, or each selected character tagged
+//with its index among the positions, plus the complemented key length
+static void keySymbols(const std::string& key, const KeyPositions& positions, std::vector<uint32_t>& symbols){
+    symbols.clear();
+    if(!positions.active()){
+        for(const char& ch : key) symbols.push_back(static_cast<uint32_t>(ch));
+        return;
+    }
+
+    for(size_t j = 0; j < positions.positions.size(); j++){
+        const uint8_t ch = KeyPositions::at(key.data(), key.size(), positions.positions[j]);
+        symbols.push_back(uint32_t(ch) | uint32_t(j << 8));
+    }
+    if(positions.use_size) symbols.push_back(~uint32_t(key.size()));
+}
+
+//The xor of hash() over keySymbols(), without collecting the symbols
+static uint32_t hash(const char* key, size_t size, const Coeffs& c, const KeyPositions& positions){
     uint32_t h = 0;
+    if(!positions.active()){
+        for(size_t i = 0; i < size; i++) h ^= hash(key[i], c);
+        return h;
+    }
 
-    for(const char& ch : key)
-        h ^= hash(ch);
+    for(size_t j = 0; j < positions.positions.size(); j++){
+        const uint8_t ch = KeyPositions::at(key, size, positions.positions[j]);
+        h ^= hash(uint32_t(ch) | uint32_t(j << 8), c);
+    }
+    if(positions.use_size) h ^= hash(~uint32_t(size), c);
 
     return h;
 }
 
+static uint32_t hash(const std::string& key, const Coeffs& c, const KeyPositions& positions){
+    return hash(key.data(), key.size(), c, positions);
+}
+
+static inline uint32_t hash(uint32_t key, const Coeffs& c, const KeyPositions&){
+    return hash(key, c);
+}
+
 std::string hashStr(uint32_t){
     std::string str =
 "    static inline constexpr uint32_t hash(uint32_t a) noexcept{\n";
@@ -60,64 +97,553 @@ std::string hashStr(uint32_t){
     return str;
 }
 
-std::string hashStr(uint32_t, size_t n, const std::string& default_value, std::string map_name, std::string key_type, bool nonKeyLookups){
-    std::string hash = hashStr(uint32_t()) +
+//hashStr(uint32_t) on eight lanes at once, for find_batch()
+std::string hashSimdStr(){
+    std::string str =
+"    #ifdef __AVX2__\n"
+"    static inline __m256i hash(__m256i a) noexcept{\n";
+    if(c[0] && c[1])
+        str += "        a = _mm256_xor_si256(_mm256_xor_si256(a, _mm256_set1_epi32(" + std::to_string(c[0]) + ")), _mm256_srli_epi32(a, " + std::to_string(c[1]) + "));\n";
+    else if(c[0])
+        str += "        a = _mm256_xor_si256(a, _mm256_xor_si256(a, _mm256_set1_epi32(" + std::to_string(c[0]) + ")));\n";
+    else if(c[1])
+        str += "        a = _mm256_xor_si256(a, _mm256_srli_epi32(a, " + std::to_string(c[1]) + "));\n";
+
+    if(c[2]) str += "        a = _mm256_add_epi32(a, _mm256_slli_epi32(a, " + std::to_string(c[2]) + "));\n";
+    if(c[3]) str += "        a = _mm256_xor_si256(a, _mm256_srli_epi32(a, " + std::to_string(c[3]) + "));\n";
+    if(c[4]) str += "        a = _mm256_mullo_epi32(a, _mm256_set1_epi32(" + std::to_string(c[4]+1) + "));\n";
+    if(c[5]) str += "        a = _mm256_xor_si256(a, _mm256_srli_epi32(a, " + std::to_string(c[5]) + "));\n";
+
+    str += "        return a;\n"
+           "    }\n"
+           "    #endif\n";
+
+    return str;
+}
+
+template<typename KeyType>
+std::string hashStr(KeyType, const SlotRange& n, const std::string& default_value, std::string map_name, std::string key_type, bool nonKeyLookups, const SearchOptions& options, const KeyPositions&, bool stashed){
+    std::string hash = hashStr(uint32_t()) + hashSimdStr() +
         "};\n"
         "\n"
-        "constexpr std::string_view " + map_name + "::lookup(const " + key_type + "& key) noexcept{\n"
-        "    const size_t h = hash(key) & " + std::to_string(n) + ";\n";
+        "constexpr std::string_view " + map_name + "::lookup(" + keyParam(key_type) + ") noexcept{\n"
+        "    const size_t h = " + n.str("hash(key)") + ";\n";
     if(nonKeyLookups) hash +=
-        "    return keys[h] == key ? std::string_view(&flat_vals[val_start[h]], val_size[h]) : \"" + default_value + "\";\n";
+        "    return " + slotRef("keys", "h", options.interleave_slots) + " == key ? " + valueStr("h", options.interleave_slots) + " : " + missStr("key", default_value, stashed) + ";\n";
     else hash +=
         "    #ifndef NDEBUG\n"
         "    assert(keys[h] == key);\n"
         "    #endif\n\n"
-        "    return std::string_view(&flat_vals[val_start[h]], val_size[h]);\n";
+        "    return " + valueStr("h", options.interleave_slots) + ";\n";
 
     hash += "}\n\n";
 
+    hash += lookupBatchStr(map_name, key_type,
+        "        for(size_t i = 0; i < count; i++)\n"
+        "            bins[i] = " + n.str("hash(queries[start+i])") + ";\n",
+        default_value, nonKeyLookups, options, stashed);
+
+    hash += findBatchStr(map_name, key_type, sizeof(KeyType), "",
+        "        __m256i bins = hash(x);\n" + n.simdStr("bins", "        "),
+        "        const size_t bin = " + n.str("hash(key)") + ";\n",
+        nonKeyLookups, options, stashed);
+
+    hash += slotValueStr(map_name, default_value, options);
+
     return hash;
 }
 
-std::string hashStr(const std::string&, size_t n, const std::string& default_value, std::string map_name, std::string key_type, bool nonKeyLookups){
+//The unrolled hash over the selected positions, matching keySymbols(). Keys shorter than the shortest key
+//can't be in the map, so they hash to slot 0 and fail the length check there.
+std::string hashPositionsStr(const KeyPositions& positions, bool nonKeyLookups){
+    std::string str;
+    if(nonKeyLookups && positions.min_size && !positions.positions.empty())
+        str += "        if(key.size() < " + std::to_string(positions.min_size) + ") return 0;\n";
+
+    std::vector<std::string> terms;
+    for(size_t j = 0; j < positions.positions.size(); j++)
+        terms.push_back("hash(uint32_t(uint8_t(" + positions.str(positions.positions[j]) + "))"
+                        + (j ? " | " + std::to_string(j << 8) + "u" : "") + ")");
+    if(positions.use_size) terms.push_back("hash(~uint32_t(key.size()))");
+
+    str += "        return " + terms[0];
+    for(size_t j = 1; j < terms.size(); j++)
+        str += "\n             ^ " + terms[j];
+    str += ";\n";
+
+    return str;
+}
+
+std::string hashStr(const std::string&, const SlotRange& n, const std::string& default_value, std::string map_name, std::string key_type, bool nonKeyLookups, const SearchOptions& options, const KeyPositions& positions, bool stashed){
     std::string hash = hashStr(uint32_t()) + "\n"
-"    static inline uint32_t hash(const " + key_type + "& key) noexcept{\n"
+"    static inline uint32_t hash(" + keyParam(key_type) + ") noexcept{\n";
+    if(positions.active()) hash += hashPositionsStr(positions, nonKeyLookups);
+    else hash +=
 "        uint32_t h = 0;\n"
 "\n"
 "        for(size_t i = key.size()-1; i < std::numeric_limits<size_t>::max(); i--)\n"
 "            h ^= hash(key[i]);\n"
 "\n"
-"        return h;\n"
+"        return h;\n";
+    hash +=
 "    }\n"
 "};\n"
 "\n"
-"std::string_view " + map_name + "::lookup(const " + key_type + "& key) noexcept{\n"
-"    const size_t h = hash(key) & " + std::to_string(n) + ";\n";
+"std::string_view " + map_name + "::lookup(" + keyParam(key_type) + ") noexcept{\n"
+"    const size_t h = " + n.str("hash(key)") + ";\n";
     if(nonKeyLookups) hash +=
-"    return checkBin(key, h) ? std::string_view(&flat_vals[val_start[h]], val_size[h]) : \"" + default_value + "\";\n";
+"    return checkBin(key, h) ? " + valueStr("h", options.interleave_slots) + " : " + missStr("key", default_value, stashed) + ";\n";
     else hash +=
 "    #ifndef NDEBUG\n"
 "    assert(checkBin(key, h));\n"
 "    #endif\n\n"
-"    return std::string_view(&flat_vals[val_start[h]], val_size[h]);\n";
+"    return " + valueStr("h", options.interleave_slots) + ";\n";
 
     hash += "}\n\n";
 
+    hash += lookupBatchStr(map_name, key_type,
+        "        for(size_t i = 0; i < count; i++)\n"
+        "            bins[i] = " + n.str("hash(queries[start+i])") + ";\n",
+        default_value, nonKeyLookups, options, stashed);
+
     return hash;
 }
 
+static void hashBlock(const uint32_t* keys, uint32_t* slots, const Coeffs& c, uint32_t n){
+    static const HashBlockKernel kernel = hashBlockKernel();
+
+    if(kernel){
+        kernel(keys, slots, c, n);
+    }else{
+        for(size_t i = 0; i < hash_block; i++)
+            slots[i] = hash(keys[i], c) & n;
+    }
+}
+
+//Occupancy of the final table. Only the words holding the slots that were set get cleared afterwards,
+//so the reset cost follows the number of keys rather than the table size.
+struct SlotBitset{
+    std::vector<uint64_t> words;
+
+    SlotBitset(size_t n) : words(n/64 + 1, 0) {}
+
+    bool testAndSet(uint32_t slot){
+        uint64_t& word = words[slot >> 6];
+        const uint64_t bit = uint64_t(1) << (slot & 63);
+        if(word & bit) return true;
+        word |= bit;
+        return false;
+    }
+
+    void clear(const std::vector<uint32_t>& slots, size_t num_set){
+        for(size_t i = 0; i < num_set; i++)
+            words[slots[i] >> 6] = 0;
+    }
+};
+
+//Per-thread collision test for integer keys. Keys are hashed a block at a time, and a block is checked
+//before the next is hashed, so most candidates are rejected after a block or two. A candidate collides once
+//more keys than stash_size land on taken slots.
+template<typename KeyType>
+struct CollisionChecker{
+    SlotRange n;
+    uint32_t mask;
+    size_t num_keys;
+    size_t stash_size;
+    std::vector<uint32_t> keys;
+    std::vector<uint32_t> slots;
+    SlotBitset occupied;
+
+    CollisionChecker(const std::vector<KeyType>& keys, const SlotRange& n, const KeyPositions&, size_t stash_size)
+        : n(n), num_keys(keys.size()), stash_size(stash_size), keys(keys.begin(), keys.end()), occupied(n.n){
+        assert(n.n <= std::numeric_limits<uint32_t>::max());
+
+        //Power-of-two tables are masked in the kernel, other sizes are reduced per key
+        mask = n.multiply_shift ? std::numeric_limits<uint32_t>::max() : n.n;
+
+        //Padding lanes are hashed but never checked
+        const size_t padded = (num_keys + hash_block - 1) / hash_block * hash_block;
+        this->keys.resize(padded, 0);
+        slots.resize(padded);
+    }
+
+    bool hasCollisions(const Coeffs& c){
+        size_t num_set = 0;
+        size_t stashed = 0;
+        bool collision = false;
+
+        for(size_t i = 0; i < num_keys && !collision; i += hash_block){
+            hashBlock(&keys[i], &slots[i], c, mask);
+
+            const size_t end = std::min(i + hash_block, num_keys);
+            for(; num_set < end; num_set++){
+                if(n.multiply_shift) slots[num_set] = n(slots[num_set]);
+                if(occupied.testAndSet(slots[num_set]) && ++stashed > stash_size){
+                    collision = true;
+                    break;
+                }
+            }
+        }
+
+        occupied.clear(slots, num_set);
+
+        return collision;
+    }
+};
+
+//Per-thread collision test for string keys. A key hashes to the XOR of hash(ch) over its characters, so
+//characters that occur an even number of times cancel and the order is irrelevant. Each key is reduced
+//to the characters it holds an odd number of times, and each candidate hashes the alphabet of the key set
+//once into a table, leaving a few XORs of table lookups per key.
+template<>
+struct CollisionChecker<std::string>{
+    SlotRange n;
+    size_t stash_size;
+    std::vector<uint32_t> alphabet;
+    std::vector<uint32_t> char_hashes;
+    std::vector<uint32_t> key_chars;
+    std::vector<size_t> key_start;
+    std::vector<uint32_t> slots;
+    SlotBitset occupied;
+    size_t anagrams = 0;
+
+    CollisionChecker(const std::vector<std::string>& keys, const SlotRange& n, const KeyPositions& positions, size_t stash_size)
+        : n(n), stash_size(stash_size), slots(keys.size()), occupied(n.n){
+        assert(n.n <= std::numeric_limits<uint32_t>::max());
+
+        std::unordered_map<uint32_t, uint32_t> alphabet_index;
+        std::vector<std::vector<uint32_t>> reduced_keys;
+        std::vector<uint32_t> symbols;
+        for(const std::string& key : keys){
+            keySymbols(key, positions, symbols);
+
+            std::vector<uint32_t> indices;
+            for(const uint32_t& symbol : symbols){
+                const auto inserted = alphabet_index.emplace(symbol, alphabet.size());
+                if(inserted.second) alphabet.push_back(symbol);
+                indices.push_back(inserted.first->second);
+            }
+
+            //Symbols appearing an even number of times cancel out of the xor
+            std::sort(indices.begin(), indices.end());
+            key_start.push_back(key_chars.size());
+            reduced_keys.emplace_back();
+            for(size_t i = 0; i < indices.size(); i++){
+                if(i+1 < indices.size() && indices[i] == indices[i+1]){
+                    i++;
+                    continue;
+                }
+                key_chars.push_back(indices[i]);
+                reduced_keys.back().push_back(indices[i]);
+            }
+        }
+        key_start.push_back(key_chars.size());
+
+        //Keys with the same odd characters, such as anagrams, collide under every candidate
+        std::sort(reduced_keys.begin(), reduced_keys.end());
+        for(size_t i = 1; i < reduced_keys.size(); i++) anagrams += reduced_keys[i] == reduced_keys[i-1];
+
+        const size_t padded = (alphabet.size() + hash_block - 1) / hash_block * hash_block;
+        alphabet.resize(padded, 0);
+        char_hashes.resize(padded);
+    }
+
+    bool hasCollisions(const Coeffs& c){
+        if(anagrams > stash_size) return true;
+
+        for(size_t i = 0; i < alphabet.size(); i += hash_block)
+            hashBlock(&alphabet[i], &char_hashes[i], c, std::numeric_limits<uint32_t>::max());
+
+        size_t num_set = 0;
+        size_t stashed = 0;
+        bool collision = false;
+
+        for(; num_set < slots.size(); num_set++){
+            uint32_t h = 0;
+            for(size_t i = key_start[num_set]; i < key_start[num_set+1]; i++)
+                h ^= char_hashes[key_chars[i]];
+
+            slots[num_set] = n(h);
+            if(occupied.testAndSet(slots[num_set]) && ++stashed > stash_size){
+                collision = true;
+                break;
+            }
+        }
+
+        occupied.clear(slots, num_set);
+
+        return collision;
+    }
+};
+
+//Instructions each nonzero coefficient adds to the generated hash, matching hashStr()
+constexpr std::array<uint8_t, 6> coeff_cost {1, 2, 2, 2, 1, 2};
+
+//Numbers the candidate coefficients. The lexicographic order follows the nested loops with c[0] outermost
+//and c[5] innermost. The cost order visits candidates in tiers by number of nonzero coefficients, then by
+//instruction cost, so the first collision-free candidate is the best one.
+struct CandidateOrder{
+    struct Tier{
+        uint8_t active;
+        size_t start;
+    };
+
+    bool cost_ordered;
+    size_t total = 0;
+    std::vector<Tier> tiers;
+
+    CandidateOrder(bool cost_ordered) : cost_ordered(cost_ordered){
+        for(size_t i = 0; i < c.size(); i++){
+            assert(c_min[i] <= c_max[i]);
+            assert(i == 0 || i == 4 || c_max[i] < 32); //Larger shifts are undefined
+        }
+
+        if(!cost_ordered){
+            total = 1;
+            for(size_t i = 0; i < c.size(); i++)
+                total *= c_max[i] - c_min[i] + 1;
+            return;
+        }
+
+        std::vector<uint8_t> masks;
+        for(uint8_t mask = 0; mask < (1 << c.size()); mask++)
+            if(isFeasible(mask)) masks.push_back(mask);
+
+        std::stable_sort(masks.begin(), masks.end(), [](uint8_t a, uint8_t b){
+            return std::make_pair(numActive(a), cost(a)) < std::make_pair(numActive(b), cost(b));
+        });
+
+        for(uint8_t mask : masks){
+            tiers.push_back({mask, total});
+            size_t count = 1;
+            for(size_t i = 0; i < c.size(); i++)
+                if(mask & (1 << i)) count *= c_max[i] - lowestNonzero(i) + 1;
+            total += count;
+        }
+    }
+
+    static uint8_t numActive(uint8_t mask){
+        uint8_t num = 0;
+        for(size_t i = 0; i < c.size(); i++) num += (mask >> i) & 1;
+        return num;
+    }
+
+    static uint8_t cost(uint8_t mask){
+        uint8_t sum = 0;
+        for(size_t i = 0; i < c.size(); i++)
+            if(mask & (1 << i)) sum += coeff_cost[i];
+        return sum;
+    }
+
+    static uint32_t lowestNonzero(size_t i){
+        return std::max<uint32_t>(c_min[i], 1);
+    }
+
+    static bool isFeasible(uint8_t mask){
+        //With c[1] == 0 the first line reduces to a = c[0], so every key collides
+        if(!(mask & 2)) return false;
+
+        for(size_t i = 0; i < c.size(); i++){
+            if(mask & (1 << i)){
+                if(c_max[i] == 0) return false;
+            }else if(c_min[i] != 0){
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    Coeffs get(size_t index) const{
+        Coeffs coeffs;
+
+        if(!cost_ordered){
+            for(size_t i = coeffs.size()-1; i < std::numeric_limits<size_t>::max(); i--){
+                const size_t radix = c_max[i] - c_min[i] + 1;
+                coeffs[i] = c_min[i] + index % radix;
+                index /= radix;
+            }
+
+            return coeffs;
+        }
+
+        auto tier = std::upper_bound(tiers.begin(), tiers.end(), index, [](size_t index, const Tier& tier){
+            return index < tier.start;
+        }) - 1;
+        index -= tier->start;
+
+        for(size_t i = coeffs.size()-1; i < std::numeric_limits<size_t>::max(); i--){
+            if(tier->active & (1 << i)){
+                const size_t radix = c_max[i] - lowestNonzero(i) + 1;
+                coeffs[i] = lowestNonzero(i) + index % radix;
+                index /= radix;
+            }else{
+                coeffs[i] = 0;
+            }
+        }
+
+        return coeffs;
+    }
+
+    void next(Coeffs& coeffs, size_t index) const{
+        if(cost_ordered){
+            if(index+1 < total) coeffs = get(index+1);
+            return;
+        }
+
+        for(size_t i = coeffs.size()-1; i < std::numeric_limits<size_t>::max(); i--){
+            if(coeffs[i] < c_max[i]){
+                coeffs[i]++;
+                return;
+            }
+            coeffs[i] = c_min[i];
+        }
+    }
+
+    //A collision-free candidate with the lowest rank wins. The lexicographic order ranks by number of
+    //nonzero coefficients, then by index, so every thread count agrees with the serial loop on the winner.
+    uint64_t rank(const Coeffs& coeffs, size_t index) const{
+        if(cost_ordered) return index;
+        return (uint64_t(checkNonzeroCoeffs(coeffs)) << 48) | index;
+    }
+
+    size_t index(uint64_t rank) const{
+        return rank & ((uint64_t(1) << 48) - 1);
+    }
+};
+
+template<typename KeyType>
+static void searchWorker(const std::vector<KeyType>& keys,
+                         const SlotRange& n,
+                         const KeyPositions& positions,
+                         const CandidateOrder& order,
+                         std::atomic<size_t>& next_chunk,
+                         std::atomic<uint64_t>& best_rank,
+                         std::atomic<uint64_t>& candidates,
+                         size_t stash_size,
+                         SearchProgress* progress){
+    constexpr size_t chunk_size = 256;
+    CollisionChecker<KeyType> checker(keys, n, positions, stash_size);
+    uint64_t checked = 0;
+
+    for(size_t start = next_chunk.fetch_add(chunk_size); start < order.total; start = next_chunk.fetch_add(chunk_size)){
+        //Chunks are claimed in increasing order, so once a cost-ordered hit exists nothing later can beat it
+        if(order.cost_ordered && start > best_rank.load(std::memory_order_relaxed)) break;
+
+        if(progress && progress->cancelled()) break;
+        const uint64_t checked_before = checked;
+
+        const size_t end = std::min(start + chunk_size, order.total);
+        Coeffs coeffs = order.get(start);
+
+        for(size_t index = start; index < end; order.next(coeffs, index++)){
+            const uint64_t rank = order.rank(coeffs, index);
+            if(rank >= best_rank.load(std::memory_order_relaxed)) continue;
+
+            checked++;
+            if(!checker.hasCollisions(coeffs)){
+                uint64_t best = best_rank.load();
+                while(rank < best && !best_rank.compare_exchange_weak(best, rank));
+                if(order.cost_ordered) break;
+            }
+        }
+
+        if(progress) progress->candidates.fetch_add(checked - checked_before, std::memory_order_relaxed);
+    }
+
+    candidates += checked;
+}
+
 template<typename KeyType>
-static bool hasCollisions(const std::vector<KeyType>& keys, size_t n, std::vector<bool>& hash_table){
-    for(size_t i = n; i < std::numeric_limits<size_t>::max(); i--)
-        hash_table[i] = false;
+static bool searchCoefficients(const std::vector<KeyType>& keys, const SlotRange& n, const KeyPositions& positions, const SearchOptions& options, Coeffs& best_c, SearchStats& stats){
+    const CandidateOrder order(options.cost_ordered);
+    const unsigned num_threads = numThreads(options);
+    std::atomic<size_t> next_chunk(0);
+    std::atomic<uint64_t> best_rank(std::numeric_limits<uint64_t>::max());
+    std::atomic<uint64_t> candidates(0);
+
+    std::vector<std::thread> workers;
+    for(unsigned i = 1; i < num_threads; i++)
+        workers.emplace_back(searchWorker<KeyType>, std::cref(keys), std::cref(n), std::cref(positions), std::cref(order), std::ref(next_chunk), std::ref(best_rank), std::ref(candidates), options.stash_size, options.progress);
+    searchWorker<KeyType>(keys, n, positions, order, next_chunk, best_rank, candidates, options.stash_size, options.progress);
+    for(std::thread& worker : workers) worker.join();
+
+    stats.candidates = candidates;
+    if(options.progress && options.progress->cancelled()){
+        stats.cancelled = true;
+        return false;
+    }
+
+    if(best_rank == std::numeric_limits<uint64_t>::max()) return false;
+
+    best_c = order.get(order.index(best_rank));
+    return true;
+}
 
-    for(size_t i = keys.size()-1; i < std::numeric_limits<size_t>::max(); i--){
-        uint32_t h = hash(keys[i]) & n;
-        if(hash_table[h]) return true;
-        hash_table[h] = true;
+//The tables hashSearch() finds, before any code is generated
+struct SearchResult{
+    SlotRange n {};
+    KeyPositions positions;
+    Coeffs c {};
+    std::vector<int> mapping; //Key index by slot, or -1 for an empty slot
+    std::vector<uint32_t> stash; //Keys whose slot holds an earlier key, up to SearchOptions::stash_size
+    SearchStats stats;
+};
+
+template<typename KeyType>
+bool findHash(const std::vector<KeyType>& keys,
+              uint8_t expansion,
+              uint8_t reduction,
+              const SearchOptions& options,
+              SearchResult& result){
+    result.n = getSlotRange(keys.size() * expansion / double(reduction) / options.load_factor, options);
+    result.stats = SearchStats();
+    result.stats.engine = 1;
+    result.stats.num_keys = keys.size();
+    result.stats.final_slots = result.n.size();
+
+    auto start = std::chrono::steady_clock::now();
+    result.positions = options.key_positions ? selectKeyPositions(keys) : KeyPositions();
+    result.stats.positions_seconds = secondsSince(start);
+
+    start = std::chrono::steady_clock::now();
+    const bool found = searchCoefficients(keys, result.n, result.positions, options, result.c, result.stats);
+    result.stats.search_seconds = secondsSince(start);
+    if(!found) return false;
+
+    result.mapping.assign(result.n.size(), -1);
+    result.stash.clear();
+    for(size_t i = 0; i < keys.size(); i++){
+        int& slot = result.mapping[result.n(hash(keys[i], result.c, result.positions))];
+        if(slot == -1) slot = int(i);
+        else result.stash.push_back(uint32_t(i));
     }
+    result.stats.stashed_keys = result.stash.size();
 
-    return false;
+    return true;
+}
+
+template<typename KeyType>
+void writeHash(const std::vector<KeyType>& keys,
+               const std::vector<std::string>& vals,
+               const SearchResult& result,
+               std::string& hash_str,
+               std::string map_name,
+               const std::string& default_value,
+               bool nonKeyLookups,
+               const SearchOptions& options,
+               size_t* table_bytes = nullptr){
+    //Stashed keys are told apart by comparison, so their keys are stored even for lookups that can't miss
+    const bool stashed = !result.stash.empty();
+    if(stashed) nonKeyLookups = true;
+    c = result.c;
+    hash_str = getCommonCodeGen(keys, vals, stashedMapping(result.mapping, result.stash), result.n.n, map_name, default_value, nonKeyLookups, options, table_bytes);
+
+    hash_str += hashStr(keys[0], result.n, default_value, map_name, typeStr(keys[0]), nonKeyLookups, options, result.positions, stashed);
+
+    std::string upper_name = map_name;
+    std::transform(upper_name.begin(), upper_name.end(), upper_name.begin(), toupper);
+    hash_str += "#endif // POIFECT_" + upper_name + "_H\n";
 }
 
 template<typename KeyType>
@@ -128,46 +654,23 @@ bool hashSearch(const std::vector<KeyType>& keys,
                 std::string default_value = "",
                 uint8_t expansion = 1,
                 uint8_t reduction = 1,
-                bool nonKeyLookups = true){
+                bool nonKeyLookups = true,
+                const SearchOptions& options = SearchOptions(),
+                SearchStats* stats = nullptr){
     assert(keys.size() > 1);
     assert(!hasDuplicates(keys));
     assert(vals.size() == keys.size());
 
-    size_t n = getModulusBitmask(keys.size() * expansion / reduction);
-    std::vector<bool> hash_table(n+1, false);
-    uint8_t best_num_c = c.size()+1;
-    std::array<uint32_t, c.size()> best_c;
-
-    #define ITERATE_INDEX(i) for(c[i] = c_min[i]; c[i] <= c_max[i]; c[i]++)
-
-    ITERATE_INDEX(0)
-    ITERATE_INDEX(1)
-    ITERATE_INDEX(2)
-    ITERATE_INDEX(3)
-    ITERATE_INDEX(4)
-    ITERATE_INDEX(5)
-    {
-        const uint8_t num_c = checkNonzeroCoeffs();
-        if(num_c < best_num_c && !hasCollisions(keys, n, hash_table)){
-            best_num_c = num_c;
-            best_c = c;
-        }
+    SearchResult result;
+    if(!findHash(keys, expansion, reduction, options, result)){
+        if(stats) *stats = result.stats;
+        return false;
     }
 
-    if(best_num_c == c.size()+1) return false;
-
-    c = best_c;
-    std::vector<int> mapping(n+1, -1);
-    for(size_t i = keys.size()-1; i < std::numeric_limits<size_t>::max(); i--)
-        mapping[hash(keys[i])&n] = i;
-
-    hash_str = getCommonCodeGen(keys, vals, mapping, n, map_name, nonKeyLookups);
-
-    hash_str += hashStr(keys[0], n, default_value, map_name, typeStr(keys[0]), nonKeyLookups);
-
-    std::string upper_name = map_name;
-    std::transform(upper_name.begin(), upper_name.end(), upper_name.begin(), toupper);
-    hash_str += "#endif // POIFECT_" + upper_name + "_H\n";
+    const auto start = std::chrono::steady_clock::now();
+    writeHash<KeyType>(keys, vals, result, hash_str, map_name, default_value, nonKeyLookups, options, &result.stats.table_bytes);
+    result.stats.generate_seconds = secondsSince(start);
+    if(stats) *stats = result.stats;
 
     return true;
 }
@@ -2,209 +2,1401 @@
 #define HASHSEARCH2_H
 
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert>
+#include <cstdio>
 #include <limits>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 #include "hashutil.h"
 
 typedef uint16_t SeedType;
 
-uint32_t hash2(const std::string& key, const SeedType& coeff){
+uint32_t hash2(const char* key, size_t size, const SeedType& coeff){
     uint32_t h = 0;
 
-    for(const char& ch : key)
-        h = h*coeff + ch;
+    for(size_t i = 0; i < size; i++)
+        h = h*coeff + key[i];
 
     return h;
 }
 
+uint32_t hash2(const std::string& key, const SeedType& coeff){
+    return hash2(key.data(), key.size(), coeff);
+}
+
+//The polynomial over the selected positions, with the key length as the last term when it's used. With only
+//a few terms and a small coefficient the sum spans a narrow range, so it's scrambled before the low bits are taken.
+uint32_t hash2(const char* key, size_t size, const SeedType& coeff, const KeyPositions& positions){
+    if(!positions.active()) return hash2(key, size, coeff);
+
+    uint32_t h = 0;
+    for(const int& pos : positions.positions)
+        h = h*coeff + KeyPositions::at(key, size, pos);
+    if(positions.use_size)
+        h = h*coeff + uint32_t(size);
+
+    h *= 2654435769u;
+    return h ^ (h >> 16);
+}
+
+uint32_t hash2(const std::string& key, const SeedType& coeff, const KeyPositions& positions){
+    return hash2(key.data(), key.size(), coeff, positions);
+}
+
 uint32_t hash2(size_t x, const SeedType& coeff){
     x = ((x >> 7) ^ x) * coeff;
     x = (x >> 7) ^ x;
     return x;
 }
 
-std::string hashStr2(const std::string&, uint16_t seed, size_t n1, size_t n2, const std::string& default_value, std::string map_name, std::string key_type, bool nonKeyLookups){
+uint32_t hash2(size_t x, const SeedType& coeff, const KeyPositions&){
+    return hash2(x, coeff);
+}
+
+//Partitioned maps split keys by hash(key, partition_seed) onto partition_range. Each partition has its own
+//layer-1 seed s0 and its own runs of the concatenated seeds and final slots. A table of partitions ends in one
+//more entry marking the end of the last, so each partition's table sizes are the differences to the next entry.
+constexpr SeedType partition_seed = 40503;
+
+struct Partition{
+    uint32_t seed_start;
+    uint32_t slot_start;
+    uint32_t s0;
+};
+
+SlotRange partitionRange(size_t num_partitions){
+    return {num_partitions-1, true};
+}
+
+static std::string partitionIndexStr2(const std::vector<Partition>& partitions, const std::string& key){
+    return partitionRange(partitions.size()-1).str("hash(" + key + ", " + std::to_string(partition_seed) + ")");
+}
+
+//Where partition p's run of the seeds or slots starts, plus h reduced onto the run
+static std::string partitionedStr2(const std::string& table, const std::string& h){
+    return "partitions[p]." + table + "_start + reduce(" + h + ", partitions[p+1]." + table + "_start - partitions[p]." + table + "_start)";
+}
+
+static std::string partitionedBinStr2(const std::vector<Partition>& partitions, const std::string& key, const std::string& seed_lookup, const std::string& indent){
+    return indent + "const size_t p = " + partitionIndexStr2(partitions, key) + ";\n"
+         + indent + "const size_t h1 = " + partitionedStr2("seed", "hash(" + key + ", partitions[p].s0)") + ";\n"
+         + indent + "const uint32_t s1 = " + seed_lookup + ";\n"
+         + indent + "const size_t bin = " + partitionedStr2("slot", "hash(" + key + ", s1)") + ";\n";
+}
+
+//The partition table, and the reduction onto a partition's run, which is a power of two long unless the map
+//uses multiply-shift
+static std::string writePartitions(const std::vector<Partition>& partitions, const SlotRange& n2, size_t& table_bytes){
+    table_bytes += partitions.size() * 3*sizeof(uint32_t);
+    std::string str =
+        "    struct Partition{\n"
+        "        uint32_t seed_start;\n"
+        "        uint32_t slot_start;\n"
+        "        uint32_t s0;\n"
+        "    };\n"
+        "\n"
+        "    //" + std::to_string(partitions.size()-1) + " partitions, and the end of the last\n"
+        "    static constexpr std::array<Partition, " + std::to_string(partitions.size()) + "> partitions {{\n        ";
+    for(size_t i = 0; i < partitions.size(); i++){
+        if(i && i%entries_per_row==0) str += "\n        ";
+        str += "{" + std::to_string(partitions[i].seed_start) + "," + std::to_string(partitions[i].slot_start) + ","
+               + std::to_string(partitions[i].s0) + "},";
+    }
+    str += "\n    }};\n\n";
+
+    str += "    static inline constexpr size_t reduce(uint32_t h, size_t size) noexcept{\n"
+           "        return " + n2.sizedStr("h", "size") + ";\n"
+           "    }\n\n";
+
+    return str;
+}
+
+//The lookup_batch() stages of a partitioned map: partitions with their entries prefetched, then layer-1 hashes
+//with their seeds prefetched, then the final-layer hashes
+std::string partitionedStages2(const std::vector<Partition>& partitions, const std::string& seed_lookup, const std::string& seed_address){
+    return
+        "        size_t ps[group];\n"
+        "        for(size_t i = 0; i < count; i++){\n"
+        "            const size_t p = " + partitionIndexStr2(partitions, "queries[start+i]") + ";\n"
+        "            POIFECT_PREFETCH(&partitions[p]);\n"
+        "            ps[i] = p;\n"
+        "        }\n"
+        "\n"
+        "        size_t h1s[group];\n"
+        "        for(size_t i = 0; i < count; i++){\n"
+        "            const size_t p = ps[i];\n"
+        "            const size_t h1 = " + partitionedStr2("seed", "hash(queries[start+i], partitions[p].s0)") + ";\n"
+        "            POIFECT_PREFETCH(" + seed_address + ");\n"
+        "            h1s[i] = h1;\n"
+        "        }\n"
+        "\n"
+        "        for(size_t i = 0; i < count; i++){\n"
+        "            const size_t p = ps[i];\n"
+        "            const size_t h1 = h1s[i];\n"
+        "            const uint32_t s1 = " + seed_lookup + ";\n"
+        "            bins[i] = " + partitionedStr2("slot", "hash(queries[start+i], s1)") + ";\n"
+        "        }\n";
+}
+
+//The lookup_batch() stages that find each query's bin: layer-1 hashes with their seeds prefetched, then the
+//final-layer hashes
+std::string hashStages2(uint16_t seed, const SlotRange& n1, const SlotRange& n2, const std::string& seed_lookup, const std::string& seed_address){
+    return
+        "        constexpr uint32_t s0 = " + std::to_string(seed) + ";\n"
+        "        size_t h1s[group];\n"
+        "        for(size_t i = 0; i < count; i++){\n"
+        "            const size_t h1 = " + n1.str("hash(queries[start+i], s0)") + ";\n"
+        "            POIFECT_PREFETCH(" + seed_address + ");\n"
+        "            h1s[i] = h1;\n"
+        "        }\n"
+        "\n"
+        "        for(size_t i = 0; i < count; i++){\n"
+        "            const size_t h1 = h1s[i];\n"
+        "            const uint32_t s1 = " + seed_lookup + ";\n"
+        "            bins[i] = " + n2.str("hash(queries[start+i], s1)") + ";\n"
+        "        }\n";
+}
+
+std::string hashStr2(const std::string&, uint16_t seed, const SlotRange& n1, const SlotRange& n2, const std::string& default_value, std::string map_name, std::string key_type, bool nonKeyLookups, const std::string& seed_lookup, const std::string& seed_address, const SearchOptions& options, const KeyPositions& positions, const std::vector<Partition>& partitions, bool stashed){
     std::string hash =
-        "    static inline uint32_t hash(const std::string& key, const uint32_t& coeff) noexcept{\n"
+        "    static inline uint32_t hash(std::string_view key, const uint32_t& coeff) noexcept{\n";
+    if(positions.active()){
+        //Keys shorter than the shortest key can't be in the map and fail the length check in checkBin()
+        if(nonKeyLookups && positions.min_size && !positions.positions.empty()) hash +=
+        "        if(key.size() < " + std::to_string(positions.min_size) + ") return 0;\n";
+        hash +=
+        "        uint32_t h = 0;\n";
+        for(const int& pos : positions.positions) hash +=
+        "        h = h*coeff + " + positions.str(pos) + ";\n";
+        if(positions.use_size) hash +=
+        "        h = h*coeff + uint32_t(key.size());\n";
+        hash +=
+        "        h *= 2654435769u;\n"
+        "        return h ^ (h >> 16);\n";
+    }else hash +=
         "        uint32_t h = 0;\n"
         "\n"
         "        for(size_t i = 0; i < key.size(); i++)\n"
         "            h = h*coeff + key[i];\n"
         "\n"
-        "        return h;\n"
+        "        return h;\n";
+    hash +=
         "    }\n"
         "};\n"
         "\n"
-        "std::string_view " + map_name + "::lookup(const " + key_type + "& key) noexcept{\n"
+        "std::string_view " + map_name + "::lookup(" + keyParam(key_type) + ") noexcept{\n";
+    if(!partitions.empty()) hash += partitionedBinStr2(partitions, "key", seed_lookup, "    ");
+    else hash +=
         "    constexpr uint32_t s0 = " + std::to_string(seed) + ";\n"
-        "    const size_t h1 = hash(key, s0) & " + std::to_string(n1) + ";\n"
-        "    const uint32_t& s1 = seeds[h1];\n"
-        "    const size_t bin = hash(key, s1) & " + std::to_string(n2) + ";\n";
+        "    const size_t h1 = " + n1.str("hash(key, s0)") + ";\n"
+        "    const uint32_t s1 = " + seed_lookup + ";\n"
+        "    const size_t bin = " + n2.str("hash(key, s1)") + ";\n";
     if(nonKeyLookups) hash +=
-        "    return checkBin(key, bin) ? std::string_view(&flat_vals[val_start[bin]], val_size[bin]) : \"" + default_value + "\";\n";
+        "    return checkBin(key, bin) ? " + valueStr("bin", options.interleave_slots) + " : " + missStr("key", default_value, stashed) + ";\n";
     else hash +=
         "    #ifndef NDEBUG\n"
         "    assert(checkBin(key, bin));\n"
         "    #endif\n\n"
-        "    return std::string_view(&flat_vals[val_start[bin]], val_size[bin]);\n";
+        "    return " + valueStr("bin", options.interleave_slots) + ";\n";
 
     hash += "}\n\n";
 
+    const std::string stages = partitions.empty() ? hashStages2(seed, n1, n2, seed_lookup, seed_address)
+                                                  : partitionedStages2(partitions, seed_lookup, seed_address);
+    hash += lookupBatchStr(map_name, key_type, stages, default_value, nonKeyLookups, options, stashed);
+
     return hash;
 }
 
-std::string hashStr2(size_t, uint16_t seed, size_t n1, size_t n2, const std::string& default_value, std::string map_name, std::string key_type, bool nonKeyLookups){
+//hashStr2(size_t) on four keys below 2^32, widened to 64-bit lanes, with a coefficient per lane
+std::string hashSimdStr2(){
+    return
+        "    #ifdef __AVX2__\n"
+        "    static inline __m256i hash(__m256i x, __m256i coeff) noexcept{\n"
+        "        x = _mm256_mul_epu32(_mm256_xor_si256(_mm256_srli_epi64(x, 7), x), coeff);\n"
+        "        return _mm256_xor_si256(_mm256_srli_epi64(x, 7), x);\n"
+        "    }\n"
+        "    #endif\n";
+}
+
+//The find_batch() statements setting bins from the eight queries in x. Layer-1 bins are found four lanes at a
+//time, their seeds are read lane by lane so that every seed encoding is covered, and the final bins are
+//packed back into 32-bit lanes.
+std::string binsSimdStr2(const SlotRange& n1, const SlotRange& n2, const std::string& seed_lookup){
+    return
+        "        __m256i x_lo = _mm256_cvtepu32_epi64(_mm256_castsi256_si128(x));\n"
+        "        __m256i x_hi = _mm256_cvtepu32_epi64(_mm256_extracti128_si256(x, 1));\n"
+        "        __m256i h1_lo = hash(x_lo, _mm256_set1_epi64x(s0));\n"
+        "        __m256i h1_hi = hash(x_hi, _mm256_set1_epi64x(s0));\n"
+        + n1.simd64Str("h1_lo", "        ") + n1.simd64Str("h1_hi", "        ") +
+        "        auto seed_of = [](long long h1){ return (long long)(" + seed_lookup + "); };\n"
+        "        const __m256i s1_lo = _mm256_setr_epi64x(seed_of(_mm256_extract_epi64(h1_lo, 0)), seed_of(_mm256_extract_epi64(h1_lo, 1)),\n"
+        "                                                 seed_of(_mm256_extract_epi64(h1_lo, 2)), seed_of(_mm256_extract_epi64(h1_lo, 3)));\n"
+        "        const __m256i s1_hi = _mm256_setr_epi64x(seed_of(_mm256_extract_epi64(h1_hi, 0)), seed_of(_mm256_extract_epi64(h1_hi, 1)),\n"
+        "                                                 seed_of(_mm256_extract_epi64(h1_hi, 2)), seed_of(_mm256_extract_epi64(h1_hi, 3)));\n"
+        "        __m256i bin_lo = hash(x_lo, s1_lo);\n"
+        "        __m256i bin_hi = hash(x_hi, s1_hi);\n"
+        + n2.simd64Str("bin_lo", "        ") + n2.simd64Str("bin_hi", "        ") +
+        "        const __m256i even = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);\n"
+        "        __m256i bins = _mm256_permute2x128_si256(_mm256_permutevar8x32_epi32(bin_lo, even),\n"
+        "                                                 _mm256_permutevar8x32_epi32(bin_hi, even), 0x20);\n";
+}
+
+template<typename KeyType>
+std::string hashStr2(KeyType, uint16_t seed, const SlotRange& n1, const SlotRange& n2, const std::string& default_value, std::string map_name, std::string key_type, bool nonKeyLookups, const std::string& seed_lookup, const std::string& seed_address, const SearchOptions& options, const KeyPositions&, const std::vector<Partition>& partitions, bool stashed){
     std::string hash =
         "    static inline constexpr uint32_t hash(size_t x, const uint32_t& coeff) noexcept{\n"
         "        x = ((x >> 7) ^ x) * coeff;\n"
         "        x = (x >> 7) ^ x;\n"
         "        return x;\n"
         "    }\n"
+        + hashSimdStr2() +
         "};\n"
         "\n"
-        "constexpr std::string_view " + map_name + "::lookup(const " + key_type + "& key) noexcept{\n"
+        "constexpr std::string_view " + map_name + "::lookup(" + keyParam(key_type) + ") noexcept{\n";
+    if(!partitions.empty()) hash += partitionedBinStr2(partitions, "key", seed_lookup, "    ");
+    else hash +=
         "    constexpr uint32_t s0 = " + std::to_string(seed) + ";\n"
-        "    const size_t h1 = hash(key, s0) & " + std::to_string(n1) + ";\n"
-        "    const uint32_t& s1 = seeds[h1];\n"
-        "    const size_t bin = hash(key,s1) & " + std::to_string(n2) + ";\n";
+        "    const size_t h1 = " + n1.str("hash(key, s0)") + ";\n"
+        "    const uint32_t s1 = " + seed_lookup + ";\n"
+        "    const size_t bin = " + n2.str("hash(key,s1)") + ";\n";
     if(nonKeyLookups) hash +=
-        "    return keys[bin] == key ? std::string_view(&flat_vals[val_start[bin]], val_size[bin]) : \"" + default_value + "\";\n";
+        "    return " + slotRef("keys", "bin", options.interleave_slots) + " == key ? " + valueStr("bin", options.interleave_slots) + " : " + missStr("key", default_value, stashed) + ";\n";
     else hash +=
         "    #ifndef NDEBUG\n"
         "    assert(keys[bin] == key);\n"
         "    #endif\n\n"
-        "    return std::string_view(&flat_vals[val_start[bin]], val_size[bin]);\n";
+        "    return " + valueStr("bin", options.interleave_slots) + ";\n";
 
     hash += "}\n\n";
 
+    if(!partitions.empty()){
+        //Every lane would need its own partition entry, so find_batch() stays scalar
+        hash += lookupBatchStr(map_name, key_type, partitionedStages2(partitions, seed_lookup, seed_address), default_value, nonKeyLookups, options, stashed);
+        hash += findBatchStr(map_name, key_type, sizeof(KeyType), "", "", partitionedBinStr2(partitions, "key", seed_lookup, "        "), nonKeyLookups, options, stashed);
+        hash += slotValueStr(map_name, default_value, options);
+        return hash;
+    }
+
+    hash += lookupBatchStr(map_name, key_type, hashStages2(seed, n1, n2, seed_lookup, seed_address), default_value, nonKeyLookups, options, stashed);
+
+    hash += findBatchStr(map_name, key_type, sizeof(KeyType),
+        "    constexpr uint32_t s0 = " + std::to_string(seed) + ";\n",
+        binsSimdStr2(n1, n2, seed_lookup),
+        "        const size_t h1 = " + n1.str("hash(key, s0)") + ";\n"
+        "        const uint32_t s1 = " + seed_lookup + ";\n"
+        "        const size_t bin = " + n2.str("hash(key, s1)") + ";\n",
+        nonKeyLookups, options, stashed);
+
+    hash += slotValueStr(map_name, default_value, options);
+
     return hash;
 }
 
+//Keys are stored once and referred to by index. Integer keys are already contiguous in the caller's
+//vector, while string keys are packed into one character array.
 template<typename KeyType>
-struct Bin{
-    uint32_t generating_hash;
-    SeedType seed;
-    std::vector<KeyType> keys;
+struct KeyArena{
+    const std::vector<KeyType>& keys;
+
+    KeyArena(const std::vector<KeyType>& keys, const KeyPositions&) : keys(keys) {}
 
-    bool operator<(const Bin& other){
-        return keys.size() > other.keys.size();
+    size_t size() const{
+        return keys.size();
+    }
+
+    uint32_t hash(size_t i, const SeedType& coeff) const{
+        return hash2(keys[i], coeff);
+    }
+
+    //The shifts bring high bits of the product down, so every seed can give a different slot
+    static SeedType seedPeriod(const SlotRange&, const KeyPositions&){
+        return std::numeric_limits<SeedType>::max();
+    }
+
+    SeedType seedPeriod(const SlotRange& n2) const{
+        return seedPeriod(n2, KeyPositions());
     }
 };
 
+template<>
+struct KeyArena<std::string>{
+    std::vector<char> chars;
+    std::vector<size_t> start;
+    KeyPositions positions;
+
+    KeyArena(const std::vector<std::string>& keys, const KeyPositions& positions) : positions(positions){
+        size_t num_chars = 0;
+        for(const std::string& key : keys) num_chars += key.size();
+        chars.reserve(num_chars);
+        start.reserve(keys.size()+1);
+
+        for(const std::string& key : keys){
+            start.push_back(chars.size());
+            chars.insert(chars.end(), key.begin(), key.end());
+        }
+        start.push_back(chars.size());
+    }
+
+    size_t size() const{
+        return start.size()-1;
+    }
+
+    uint32_t hash(size_t i, const SeedType& coeff) const{
+        return hash2(&chars[start[i]], start[i+1]-start[i], coeff, positions);
+    }
+
+    //The polynomial hash modulo a power of two only depends on the seed modulo the same power, so seeds
+    //past the table size repeat earlier slots and a bin that fails below it fails for every seed
+    static SeedType seedPeriod(const SlotRange& n2, const KeyPositions& positions){
+        if(positions.active() || n2.multiply_shift) return std::numeric_limits<SeedType>::max();
+        return SeedType(std::min<size_t>(n2.size(), std::numeric_limits<SeedType>::max()));
+    }
+
+    SeedType seedPeriod(const SlotRange& n2) const{
+        return seedPeriod(n2, positions);
+    }
+};
+
+//The caller's keys where they are, for rebuilds, which only hash the keys of the bins they place and so
+//aren't worth packing every key for
 template<typename KeyType>
-bool testSeed(const Bin<KeyType>& bin, size_t n2, std::vector<bool>& final_layer){
-    for(size_t i = bin.keys.size()-1; i < std::numeric_limits<size_t>::max(); i--){
-        const KeyType& key = bin.keys[i];
-        const uint32_t h = hash2(key, bin.seed) & n2;
-        if(final_layer[h]){
-            for(size_t j = i + 1; j < bin.keys.size(); j++){
-                const KeyType& key = bin.keys[j];
-                const uint32_t h = hash2(key, bin.seed) & n2;
-                final_layer[h] = false;
-            }
+struct KeyRefs{
+    const std::vector<KeyType>& keys;
+    const KeyPositions& positions;
+    const std::vector<uint32_t>* indices = nullptr; //A partition's keys, or nullptr for all of them
+
+    size_t size() const{
+        return indices ? indices->size() : keys.size();
+    }
+
+    uint32_t hash(size_t i, const SeedType& coeff) const{
+        return hash2(keys[indices ? (*indices)[i] : i], coeff, positions);
+    }
+
+    SeedType seedPeriod(const SlotRange& n2) const{
+        return KeyArena<KeyType>::seedPeriod(n2, positions);
+    }
+};
+
+constexpr size_t max_keys1 = 10;
+
+//A layer-1 bucket, as a range of Layer1::order
+struct Bin{
+    uint32_t start = 0;
+    uint32_t size = 0;
+    SeedType seed = 0;
+};
+
+struct Layer1{
+    std::vector<uint32_t> h1;     //Layer-1 hash of each key
+    std::vector<uint32_t> order;  //Key indices, counting sorted by layer-1 hash
+    std::vector<Bin> bins;        //Indexed by layer-1 hash
+    std::vector<uint32_t> stash;  //Keys left out of the final layer, through SearchOptions::stash_size, kept after
+                                  //a search even where they found their slot empty
+};
+
+//final_layer is the occupancy of the final slots, a std::vector<bool> or a view onto part of one
+template<typename Keys, typename FinalLayer>
+bool testSeed(const Keys& arena, const Layer1& layer1, const Bin& bin, const SlotRange& n2, FinalLayer& final_layer){
+    std::array<uint32_t, max_keys1> slots;
+
+    for(size_t i = 0; i < bin.size; i++){
+        slots[i] = n2(arena.hash(layer1.order[bin.start+i], bin.seed));
+        if(final_layer[slots[i]]){
+            for(size_t j = 0; j < i; j++)
+                final_layer[slots[j]] = false;
 
             return false;
         }
 
-        final_layer[h] = true;
+        final_layer[slots[i]] = true;
     }
 
     return true;
 }
 
-template<typename KeyType>
-bool findSeed(Bin<KeyType>& bin, size_t n2, std::vector<bool>& final_layer){
-    for(bin.seed = 0; bin.seed < std::numeric_limits<SeedType>::max(); bin.seed++)
-        if(testSeed(bin, n2, final_layer)) return true;
+//Top-level seed trials run concurrently. A trial gives up once a trial with a lower index has succeeded,
+//since the lowest succeeding index wins regardless, or once the search is cancelled.
+struct SeedTrial{
+    const std::atomic<size_t>& lowest_success;
+    size_t index;
+    SearchProgress* progress;
+
+    bool cancelled() const{
+        return lowest_success.load(std::memory_order_relaxed) < index || (progress && progress->cancelled());
+    }
+};
+
+//Seeds a bin gets before its leftover keys go to the stash, when there is one: enough for a key to find the last
+//free slot of the final table with probability 1 - e^-16, rather than the whole seed period
+static SeedType stashSeedTries(const SlotRange& n2){
+    return SeedType(std::min<size_t>(16*n2.size(), std::numeric_limits<SeedType>::max()));
+}
+
+template<typename Keys, typename FinalLayer>
+bool findSeed(const Keys& arena, const Layer1& layer1, Bin& bin, const SlotRange& n2, FinalLayer& final_layer, const SeedTrial& trial, SearchStats& stats,
+              SeedType max_tries = std::numeric_limits<SeedType>::max()){
+    const SeedType period = std::min(arena.seedPeriod(n2), max_tries);
+    for(bin.seed = 0; bin.seed < period; bin.seed++){
+        if(trial.cancelled()) return false;
+        stats.seeds_tried[bin.size]++;
+        if(testSeed(arena, layer1, bin, n2, final_layer)){
+            stats.bins_placed[bin.size]++;
+            return true;
+        }
+    }
 
     return false;
 }
 
+static uint8_t bitWidth(size_t x){
+    uint8_t width = 1;
+    while(x >> width) width++;
+    return width;
+}
+
+static std::string bitsPerKey(size_t bits, size_t num_keys){
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "%.2f", bits / double(num_keys));
+    return buffer;
+}
+
+static std::string writePackedBits(const std::vector<uint32_t>& values, uint8_t width, std::string name, size_t& table_bytes){
+    //Two bytes of padding let the decoder read three bytes at any offset
+    std::vector<uint8_t> bytes((values.size()*width + 7)/8 + 2, 0);
+    table_bytes += bytes.size();
+    for(size_t i = 0; i < values.size(); i++)
+        for(uint8_t b = 0; b < width; b++)
+            if((values[i] >> b) & 1) bytes[(i*width + b) >> 3] |= 1 << ((i*width + b) & 7);
+
+    std::string str = "    static constexpr std::array<uint8_t, " + std::to_string(bytes.size()) + "> " + name + " {\n        ";
+    for(size_t i = 0; i < bytes.size(); i++){
+        if(i && i%entries_per_row==0) str += "\n        ";
+        str += std::to_string(bytes[i]) + ",";
+    }
+    str += "\n    };\n\n";
+
+    return str;
+}
+
+//Writes the seeds table, sets seed_lookup to the expression reading the seed of bin h1 and seed_address to
+//the address of its first byte, for prefetching. The compact encodings store each seed in the fewest bits
+//that fit the largest seed, or as an index into a dictionary of the distinct seeds, whichever is smaller,
+//with a three byte read to decode. Adds the bytes of its tables to table_bytes.
+static inline std::string writeSeeds(const Layer1& layer1, size_t num_keys, bool compact, std::string& seed_lookup, std::string& seed_address, size_t& table_bytes){
+    std::vector<uint32_t> seeds;
+    for(const Bin& bin : layer1.bins) seeds.push_back(bin.seed);
+
+    const size_t array_bits = 16*seeds.size();
+    std::string str = "    //seeds: ";
+
+    SeedType max_seed = *std::max_element(seeds.begin(), seeds.end());
+    std::vector<uint32_t> dictionary(seeds);
+    std::sort(dictionary.begin(), dictionary.end());
+    dictionary.erase(std::unique(dictionary.begin(), dictionary.end()), dictionary.end());
+
+    const uint8_t narrow_bits = max_seed <= std::numeric_limits<uint8_t>::max() ? 8 : 16;
+    const uint8_t packed_width = bitWidth(max_seed);
+    const uint8_t index_width = bitWidth(dictionary.size()-1);
+    const size_t narrow_bits_total = narrow_bits*seeds.size();
+    const size_t packed_bits = packed_width*seeds.size();
+    const size_t dictionary_bits = index_width*seeds.size() + 16*dictionary.size();
+
+    if(!compact || narrow_bits_total <= std::min(packed_bits, dictionary_bits)){
+        const std::string type = compact && narrow_bits == 8 ? "uint8_t" : "uint16_t";
+        const size_t bits = compact ? narrow_bits_total : array_bits;
+        table_bytes += bits/8;
+        str += bitsPerKey(bits, num_keys) + " bits per key as " + type + "\n";
+        if(compact) str += "    //(uint16_t layout: " + bitsPerKey(array_bits, num_keys) + " bits per key)\n";
+
+        str += "    static constexpr std::array<" + type + ", " + std::to_string(seeds.size()) + "> seeds {\n        ";
+        for(size_t i = 0; i < seeds.size(); i++){
+            if(i && i%entries_per_row==0) str += "\n        ";
+            str += std::to_string(seeds[i]) + ",";
+        }
+        str += "\n    };\n\n";
+
+        seed_lookup = "seeds[h1]";
+        seed_address = "&seeds[h1]";
+        return str;
+    }
+
+    std::string decode;
+    uint8_t width;
+
+    if(packed_bits <= dictionary_bits){
+        width = packed_width;
+        str += bitsPerKey(packed_bits, num_keys) + " bits per key, packed " + std::to_string(width) + " bits per seed\n";
+        str += "    //(uint16_t layout: " + bitsPerKey(array_bits, num_keys) + " bits per key)\n";
+        str += writePackedBits(seeds, width, "seed_bits", table_bytes);
+        decode = "(word >> (bit & 7)) & " + std::to_string((1 << width) - 1);
+    }else{
+        width = index_width;
+        str += bitsPerKey(dictionary_bits, num_keys) + " bits per key, " + std::to_string(width) + " bit indices into "
+               + std::to_string(dictionary.size()) + " distinct seeds\n";
+        str += "    //(uint16_t layout: " + bitsPerKey(array_bits, num_keys) + " bits per key)\n";
+
+        table_bytes += 2*dictionary.size();
+        str += "    static constexpr std::array<uint16_t, " + std::to_string(dictionary.size()) + "> seed_dictionary {\n        ";
+        for(size_t i = 0; i < dictionary.size(); i++){
+            if(i && i%entries_per_row==0) str += "\n        ";
+            str += std::to_string(dictionary[i]) + ",";
+        }
+        str += "\n    };\n\n";
+
+        std::vector<uint32_t> indices;
+        for(uint32_t seed : seeds)
+            indices.push_back(std::lower_bound(dictionary.begin(), dictionary.end(), seed) - dictionary.begin());
+        str += writePackedBits(indices, width, "seed_bits", table_bytes);
+        decode = "seed_dictionary[(word >> (bit & 7)) & " + std::to_string((1 << width) - 1) + "]";
+    }
+
+    str += "    static inline constexpr uint32_t seed(size_t h1) noexcept{\n"
+           "        const size_t bit = h1*" + std::to_string(width) + ";\n"
+           "        const size_t byte = bit >> 3;\n"
+           "        const uint32_t word = seed_bits[byte] | (seed_bits[byte+1] << 8) | (seed_bits[byte+2] << 16);\n"
+           "        return " + decode + ";\n"
+           "    }\n\n";
+
+    seed_lookup = "seed(h1)";
+    seed_address = "&seed_bits[h1*" + std::to_string(width) + " >> 3]";
+    return str;
+}
+
+//The tables hashSearch2() finds, before any code is generated. A partitioned search concatenates the seeds
+//and slots of its partitions, so n1 and n2 span them all and only their sizes and multiply_shift apply, s0 is
+//unused, and layer1 only holds the bins and each key's bin among them.
+struct SearchResult2{
+    SlotRange n1 {};
+    SlotRange n2 {};
+    KeyPositions positions;
+    SeedType s0 = 0;
+    Layer1 layer1;
+    std::vector<int> mapping; //Key index by final slot, or -1 for an empty slot
+    std::vector<Partition> partitions; //Empty unless partitioned
+    std::vector<uint32_t> stash; //Keys whose slot holds another key, up to SearchOptions::stash_size
+    SearchStats stats;
+};
+
 template<typename KeyType>
 void writeHash2(const std::vector<KeyType>& keys,
-               const SeedType& seed,
-               size_t n1,
-               size_t n2,
                const std::vector<std::string>& vals,
-               std::vector<Bin<KeyType>> layer1,
+               const SearchResult2& result,
                std::string& hash_str,
                std::string map_name,
                const std::string& default_value,
-               bool nonKeyLookups){
+               bool nonKeyLookups,
+               const SearchOptions& options,
+               size_t* table_bytes = nullptr){
+    //Stashed keys are told apart by comparison, so their keys are stored even for lookups that can't miss
+    const bool stashed = !result.stash.empty();
+    if(stashed) nonKeyLookups = true;
+
+    size_t bytes = 0;
+    hash_str = getCommonCodeGen(keys, vals, stashedMapping(result.mapping, result.stash), result.n2.n, map_name, default_value, nonKeyLookups, options, &bytes);
+
+    std::string seed_lookup;
+    std::string seed_address;
+    hash_str += writeSeeds(result.layer1, keys.size(), options.compact_seeds, seed_lookup, seed_address, bytes);
+    if(!result.partitions.empty()) hash_str += writePartitions(result.partitions, result.n2, bytes);
+    if(table_bytes) *table_bytes = bytes;
+
+    hash_str += hashStr2(keys[0], result.s0, result.n1, result.n2, default_value, map_name, typeStr(keys[0]), nonKeyLookups, seed_lookup, seed_address, options, result.positions, result.partitions, stashed);
+
+    std::string upper_name = map_name;
+    std::transform(upper_name.begin(), upper_name.end(), upper_name.begin(), toupper);
+    hash_str += "#endif // POIFECT_" + upper_name + "_H\n";
+}
+
+//Sorts the keys into bins by layer1.h1, given the bin sizes. A bin with max_keys1 keys or more leaves its last
+//keys to the stash, if stash_size keys cover every such bin's excess. Otherwise returns false, counting an
+//oversized trial.
+static bool sortLayer1(Layer1& layer1, size_t stash_size, SearchStats& stats){
+    const size_t num_keys = layer1.h1.size();
+    uint32_t end = 0;
+    size_t oversized = 0;
+    for(Bin& bin : layer1.bins){
+        oversized += bin.size >= max_keys1;
+        end += bin.size;
+        bin.start = end;
+    }
+
+    layer1.stash.clear();
+    if(oversized){
+        size_t excess = 0;
+        for(const Bin& bin : layer1.bins)
+            if(bin.size >= max_keys1) excess += bin.size - (max_keys1-1);
+        if(excess > stash_size){
+            stats.oversized_trials++;
+            stats.oversized_bins += oversized;
+            return false;
+        }
+
+        for(size_t i = num_keys-1; i < std::numeric_limits<size_t>::max(); i--){
+            Bin& bin = layer1.bins[layer1.h1[i]];
+            if(bin.size < max_keys1) continue;
+            layer1.stash.push_back(uint32_t(i));
+            bin.size--;
+        }
+
+        end = 0;
+        for(Bin& bin : layer1.bins){
+            end += bin.size;
+            bin.start = end;
+        }
+    }
+
+    //Filling each bin from its end leaves bin.start at the beginning of the range
+    layer1.order.resize(num_keys - layer1.stash.size());
+    if(layer1.stash.empty()){
+        for(size_t i = num_keys-1; i < std::numeric_limits<size_t>::max(); i--)
+            layer1.order[--layer1.bins[layer1.h1[i]].start] = i;
+    }else{
+        //The stash lists keys in decreasing order, as they are met here
+        size_t next_stashed = 0;
+        for(size_t i = num_keys-1; i < std::numeric_limits<size_t>::max(); i--){
+            if(next_stashed < layer1.stash.size() && layer1.stash[next_stashed] == i) next_stashed++;
+            else layer1.order[--layer1.bins[layer1.h1[i]].start] = i;
+        }
+    }
+
+    return true;
+}
+
+//Sets the layer-1 hash of every key and sorts the keys into bins by it
+template<typename KeyType>
+static bool fillLayer1(const KeyArena<KeyType>& arena, const SeedType& seed, const SlotRange& n1, Layer1& layer1, size_t stash_size, SearchStats& stats){
+    const size_t num_keys = arena.size();
+    layer1.h1.resize(num_keys);
+    layer1.bins.assign(n1.size(), Bin());
+
+    for(size_t i = 0; i < num_keys; i++){
+        layer1.h1[i] = n1(arena.hash(i, seed));
+        layer1.bins[layer1.h1[i]].size++;
+    }
+
+    return sortLayer1(layer1, stash_size, stats);
+}
+
+//For a bin none of the first max_tries seeds places whole, the one of them placing the most of its keys. The keys
+//it leaves on taken slots go to the stash, however full. Only runs once a bin has run out of seeds.
+template<typename Keys, typename FinalLayer>
+void stashSeed(const Keys& arena, Layer1& layer1, Bin& bin, const SlotRange& n2, FinalLayer& final_layer, SeedType max_tries){
+    std::array<uint32_t, max_keys1> slots;
+    auto fillSlots = [&](SeedType seed){
+        size_t left = 0;
+        for(size_t i = 0; i < bin.size; i++){
+            slots[i] = n2(arena.hash(layer1.order[bin.start+i], seed));
+            left += final_layer[slots[i]] || std::find(slots.begin(), slots.begin()+i, slots[i]) != slots.begin()+i;
+        }
+        return left;
+    };
+
+    //A seed leaving a single key out is as good as any, since none leaves out none
+    const SeedType period = std::min(arena.seedPeriod(n2), max_tries);
+    size_t best_left = bin.size;
+    for(SeedType seed = 0; seed < period && best_left > 1; seed++){
+        const size_t left = fillSlots(seed);
+        if(left < best_left){
+            best_left = left;
+            bin.seed = seed;
+        }
+    }
+
+    fillSlots(bin.seed);
+    for(size_t i = 0; i < bin.size; i++){
+        if(final_layer[slots[i]]) layer1.stash.push_back(layer1.order[bin.start+i]);
+        else final_layer[slots[i]] = true;
+    }
+}
+
+template<typename KeyType>
+static bool testSeed(const KeyArena<KeyType>& arena,
+                     const SeedType& seed,
+                     const SlotRange& n1,
+                     const SlotRange& n2,
+                     Layer1& layer1,
+                     size_t stash_size,
+                     const SeedTrial& trial,
+                     SearchStats& stats){
+    if(!fillLayer1(arena, seed, n1, layer1, stash_size, stats)) return false;
+
+    std::vector<bool> final_layer(n2.size(), false);
+
+    //Place the largest bins first, breaking ties by the highest layer-1 hash. The order is spelled out
+    //rather than left to std::sort so that poifect::make_map() can reproduce it. Progress is reported in
+    //batches to keep the shared counter off the placement loop.
+    //With a stash, every bin that runs out of its stashSeedTries() seeds is stashed, even past stash_size, so
+    //the trial's tables don't depend on stash_size and a trial that overflows still counts the stash it needed.
+    const SeedType max_tries = stash_size ? stashSeedTries(n2) : std::numeric_limits<SeedType>::max();
+    constexpr uint64_t progress_batch = 1024;
+    uint64_t placed = 0;
+    for(uint32_t size = max_keys1-1; size > 0; size--){
+        for(uint32_t h = n1.size(); h-- > 0;){
+            Bin& bin = layer1.bins[h];
+            if(bin.size != size) continue;
+            bool found = findSeed(arena, layer1, bin, n2, final_layer, trial, stats, max_tries);
+            if(!found && stash_size && !trial.cancelled()){
+                stashSeed(arena, layer1, bin, n2, final_layer, max_tries);
+                found = true;
+            }
+            if(!found){
+                if(trial.cancelled()) stats.cancelled_trials++;
+                else stats.exhausted_trials++;
+                if(trial.progress) trial.progress->bins_placed.fetch_add(placed % progress_batch, std::memory_order_relaxed);
+                return false;
+            }
+            if(trial.progress && ++placed % progress_batch == 0) trial.progress->bins_placed.fetch_add(progress_batch, std::memory_order_relaxed);
+        }
+    }
+    if(trial.progress) trial.progress->bins_placed.fetch_add(placed % progress_batch, std::memory_order_relaxed);
+
+    if(layer1.stash.size() > stash_size){
+        stats.exhausted_trials++;
+        stats.needStash(layer1.stash.size());
+        return false;
+    }
+
+    return true;
+}
+
+//Tries the top-level seeds on the table sizes and key positions already set in result, leaving at most
+//stash_size keys out of the final layer
+template<typename KeyType>
+static bool searchSeeds2(const std::vector<KeyType>& keys, unsigned num_threads, SearchProgress* progress, SearchResult2& result, size_t stash_size = 0){
+    constexpr size_t num_primes = 32;
+    const uint8_t primes[num_primes] = {  0,   1,   2,   3,   5,
+                                          7,  11,  13,  17,  19,
+                                         23,  29,  31,  37,  41,
+                                         43,  47,  53,  59,  61,
+                                         67,  71,  73,  79,  83,
+                                         89,  97, 101, 103, 107,
+                                        109, 113};
+
+    const KeyArena<KeyType> arena(keys, result.positions);
+    std::atomic<size_t> next_trial(0);
+    std::atomic<size_t> lowest_success(num_primes);
+    std::mutex best_mutex;
+
+    auto worker = [&](){
+        Layer1 layer1;
+        SearchStats stats;
+        stats.seeds_tried.assign(max_keys1, 0);
+        stats.bins_placed.assign(max_keys1, 0);
+
+        for(size_t seed = next_trial++; seed < num_primes && seed < lowest_success; seed = next_trial++){
+            if(progress){
+                if(progress->cancelled()) break;
+                progress->candidates.fetch_add(1, std::memory_order_relaxed);
+            }
+            stats.candidates++;
+            if(!testSeed<KeyType>(arena, primes[seed], result.n1, result.n2, layer1, stash_size, SeedTrial{lowest_success, seed, progress}, stats)) continue;
 
-    struct LayerSort{
-        inline bool operator() (const Bin<KeyType>& a, const Bin<KeyType>& b){
-            return (a.generating_hash < b.generating_hash);
+            std::lock_guard<std::mutex> lock(best_mutex);
+            if(seed < lowest_success){
+                lowest_success = seed;
+                std::swap(result.layer1, layer1);
+            }
         }
+
+        std::lock_guard<std::mutex> lock(best_mutex);
+        result.stats.merge(stats);
     };
-    std::sort(layer1.begin(), layer1.end(), LayerSort());
 
-    std::vector<int> mapping(n2+1, -1);
+    std::vector<std::thread> workers;
+    for(unsigned i = 1; i < num_threads; i++)
+        workers.emplace_back(worker);
+    worker();
+    for(std::thread& thread : workers) thread.join();
+
+    if(progress && progress->cancelled()) result.stats.cancelled = true;
+    if(lowest_success == num_primes || result.stats.cancelled) return false;
+
+    result.s0 = primes[lowest_success];
+    result.stats.s0 = result.s0;
+    result.stats.needed_stash = 0;
+    std::vector<uint64_t> bin_sizes(max_keys1, 0);
+    for(const Bin& bin : result.layer1.bins) bin_sizes[bin.size]++;
+    SearchStats::addCounts(result.stats.bin_sizes, bin_sizes);
+
+    result.mapping.assign(result.n2.size(), -1);
+    result.stash.clear();
+    if(result.layer1.stash.empty()){
+        for(size_t i = 0; i < keys.size(); i++){
+            const SeedType& s1 = result.layer1.bins[result.layer1.h1[i]].seed;
+            result.mapping[result.n2(arena.hash(i, s1))] = i;
+        }
+
+        return true;
+    }
+
+    std::vector<bool> stashed(keys.size(), false);
+    for(const uint32_t& i : result.layer1.stash) stashed[i] = true;
     for(size_t i = 0; i < keys.size(); i++){
-        const KeyType& key = keys[i];
-        uint32_t h = hash2(key, seed) & n1;
-        uint32_t s1 = layer1[h].seed;
-        size_t final = hash2(key, s1) & n2;
-        mapping[final] = i;
+        const SeedType& s1 = result.layer1.bins[result.layer1.h1[i]].seed;
+        if(!stashed[i]) result.mapping[result.n2(arena.hash(i, s1))] = i;
     }
 
-    hash_str = getCommonCodeGen(keys, vals, mapping, n2, map_name, nonKeyLookups);
+    //A key left out of an oversized bin may find its slot empty once every bin is placed, and then takes it
+    std::sort(result.layer1.stash.begin(), result.layer1.stash.end());
+    for(const uint32_t& i : result.layer1.stash){
+        const SeedType& s1 = result.layer1.bins[result.layer1.h1[i]].seed;
+        int& slot = result.mapping[result.n2(arena.hash(i, s1))];
+        if(slot == -1) slot = int(i);
+        else result.stash.push_back(i);
+    }
 
-    hash_str += "    static constexpr std::array<uint16_t, " + std::to_string(n1+1) + "> seeds {\n        ";
+    return true;
+}
+
+//Splits the keys into partitions of about options.partition_size keys and searches each on its own, a
+//partition per thread at a time. Only one partition's keys are copied per thread, and every partition's
+//search only grows with its own size. Partitions that fail even on twice the final slots are searched again
+//one after another, each with what is left of the stash, so the stashed keys don't depend on the threads.
+template<typename KeyType>
+static bool findPartitioned2(const std::vector<KeyType>& keys,
+                             uint8_t expansion,
+                             uint8_t reduction,
+                             const SearchOptions& options,
+                             SearchResult2& result){
+    const size_t num_partitions = (keys.size() + options.partition_size - 1) / options.partition_size;
+    const SlotRange partition_range = partitionRange(num_partitions);
+
+    //Key indices counting sorted by partition
+    std::vector<uint32_t> start(num_partitions+1, 0);
+    std::vector<uint32_t> order(keys.size());
+    {
+        std::vector<uint32_t> partition(keys.size());
+        for(size_t i = 0; i < keys.size(); i++){
+            partition[i] = partition_range(hash2(keys[i], partition_seed, result.positions));
+            start[partition[i]+1]++;
+        }
+        for(size_t p = 0; p < num_partitions; p++) start[p+1] += start[p];
 
-    size_t i = 0;
-    for(const auto& bin : layer1){
-        if(i && i%entries_per_row==0) hash_str += "\n        ";
-        i++;
-        hash_str += std::to_string(bin.seed) + ",";
+        std::vector<uint32_t> fill(start.begin(), start.end()-1);
+        for(size_t i = 0; i < keys.size(); i++) order[fill[partition[i]]++] = uint32_t(i);
     }
-    hash_str += "\n    };\n\n";
 
-    hash_str += hashStr2(keys[0], seed, n1, n2, default_value, map_name, typeStr(keys[0]), nonKeyLookups);
+    std::vector<SearchResult2> parts(num_partitions);
+    std::vector<char> stash_parts(num_partitions, false);
+    std::atomic<size_t> next_partition(0);
+    std::atomic<bool> failed(false);
 
-    std::string upper_name = map_name;
-    std::transform(upper_name.begin(), upper_name.end(), upper_name.begin(), toupper);
-    hash_str += "#endif // POIFECT_" + upper_name + "_H\n";
+    auto partitionKeys = [&](size_t p, std::vector<KeyType>& part_keys){
+        part_keys.clear();
+        for(uint32_t i = start[p]; i < start[p+1]; i++) part_keys.push_back(keys[order[i]]);
+    };
+
+    auto worker = [&](){
+        std::vector<KeyType> part_keys;
+        for(size_t p = next_partition++; p < num_partitions && !failed; p = next_partition++){
+            partitionKeys(p, part_keys);
+
+            //Even an empty partition gets tables of two slots
+            SearchResult2& part = parts[p];
+            part.n1 = getSlotRange(std::max(2.0, part_keys.size()*expansion/double(reduction)), options);
+            part.n2 = getSlotRange(std::max(2.0, part_keys.size()/options.load_factor), options);
+            part.positions = result.positions;
+
+            //Partition sizes scatter around the average, and one that fills its power-of-two table too tightly
+            //is retried once with twice the final slots rather than failing the whole build
+            if(!searchSeeds2(part_keys, 1, options.progress, part) && !part.stats.cancelled){
+                part.stats.retried_partitions++;
+                part.n2 = getSlotRange(2.0*part.n2.size(), options);
+                if(!searchSeeds2(part_keys, 1, options.progress, part) && !part.stats.cancelled){
+                    if(options.stash_size) stash_parts[p] = true;
+                    else failed = true;
+                }
+            }
+            if(part.stats.cancelled) failed = true;
+
+            //Only the seeds, the keys' bins and the mapping are kept
+            part.layer1.order = std::vector<uint32_t>();
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for(unsigned i = 1; i < numThreads(options); i++)
+        workers.emplace_back(worker);
+    worker();
+    for(std::thread& thread : workers) thread.join();
+
+    //Each partition is charged the stash its trial was allowed, so that its tables don't depend on the others
+    size_t stash_left = options.stash_size;
+    std::vector<KeyType> part_keys;
+    for(size_t p = 0; p < num_partitions && !failed; p++){
+        if(!stash_parts[p]) continue;
+        partitionKeys(p, part_keys);
+        if(!searchSeeds2(part_keys, 1, options.progress, parts[p], stash_left)) failed = true;
+        else stash_left -= parts[p].layer1.stash.size();
+        parts[p].layer1.order = std::vector<uint32_t>();
+    }
+
+    for(const SearchResult2& part : parts) result.stats.merge(part.stats);
+    if(options.progress && options.progress->cancelled()) result.stats.cancelled = true;
+
+    //With an unbounded stash every partition's first trial succeeds, and with the sum of their stashes each
+    //still fits what the partitions before it leave, so a search with that stash succeeds
+    result.stats.needed_stash = 0;
+    if(failed && options.stash_size && !result.stats.cancelled){
+        uint64_t needed_stash = 0;
+        for(size_t p = 0; p < num_partitions && !result.stats.cancelled; p++){
+            if(!stash_parts[p]) continue;
+            partitionKeys(p, part_keys);
+            if(searchSeeds2(part_keys, 1, options.progress, parts[p], std::numeric_limits<size_t>::max()))
+                needed_stash += parts[p].layer1.stash.size();
+            if(options.progress && options.progress->cancelled()) result.stats.cancelled = true;
+        }
+        if(!result.stats.cancelled) result.stats.needed_stash = needed_stash;
+    }
+
+    if(failed || result.stats.cancelled) return false;
+
+    result.s0 = 0;
+    result.layer1 = Layer1();
+    result.layer1.h1.resize(keys.size());
+    result.mapping.clear();
+    result.partitions.clear();
+    for(size_t p = 0; p < num_partitions; p++){
+        assert(result.mapping.size() + parts[p].mapping.size() <= std::numeric_limits<uint32_t>::max());
+        for(size_t k = 0; k < parts[p].layer1.h1.size(); k++)
+            result.layer1.h1[order[start[p] + k]] = uint32_t(result.layer1.bins.size()) + parts[p].layer1.h1[k];
+        result.partitions.push_back({uint32_t(result.layer1.bins.size()), uint32_t(result.mapping.size()), parts[p].s0});
+        result.layer1.bins.insert(result.layer1.bins.end(), parts[p].layer1.bins.begin(), parts[p].layer1.bins.end());
+        for(const int& slot : parts[p].mapping)
+            result.mapping.push_back(slot == -1 ? -1 : int(order[start[p] + slot]));
+        for(const uint32_t& k : parts[p].stash) result.stash.push_back(order[start[p] + k]);
+        parts[p] = SearchResult2();
+    }
+    result.partitions.push_back({uint32_t(result.layer1.bins.size()), uint32_t(result.mapping.size()), 0});
+
+    result.n1 = {result.layer1.bins.size()-1, options.multiply_shift};
+    result.n2 = {result.mapping.size()-1, options.multiply_shift};
+    result.stats.layer1_bins = result.n1.size();
+    result.stats.final_slots = result.n2.size();
+
+    return true;
 }
 
 template<typename KeyType>
-static bool testSeed(const std::vector<KeyType>& keys,
-                     const SeedType& seed,
-                     size_t n1,
-                     size_t n2,
-                     const std::vector<std::string>& vals,
-                     std::string& hash_str,
-                     std::string map_name,
-                     const std::string& default_value,
-                     bool nonKeyLookups){
-    std::vector<Bin<KeyType>> layer1(n1+1);
-    for(size_t i = 0; i <= n1; i++) layer1[i].generating_hash = i;
+bool findHash2(const std::vector<KeyType>& keys,
+               uint8_t expansion,
+               uint8_t reduction,
+               const SearchOptions& options,
+               SearchResult2& result){
+    result.stats = SearchStats();
+    result.stats.engine = 2;
+    result.stats.num_keys = keys.size();
+
+    auto start = std::chrono::steady_clock::now();
+    result.positions = options.key_positions ? selectKeyPositions(keys) : KeyPositions();
+    result.stats.positions_seconds = secondsSince(start);
+
+    start = std::chrono::steady_clock::now();
+    result.partitions.clear();
+    result.stash.clear();
+    bool found;
+    if(options.partition_size && keys.size() > options.partition_size){
+        result.stats.num_partitions = (keys.size() + options.partition_size - 1) / options.partition_size;
+        found = findPartitioned2(keys, expansion, reduction, options, result);
+    }else{
+        result.n1 = getSlotRange(keys.size()*expansion/double(reduction), options);
+        result.n2 = getSlotRange(keys.size()/options.load_factor, options);
+        result.stats.layer1_bins = result.n1.size();
+        result.stats.final_slots = result.n2.size();
+        found = searchSeeds2(keys, numThreads(options), options.progress, result, options.stash_size);
+    }
+    result.stats.search_seconds = secondsSince(start);
+    result.stats.stashed_keys = result.stash.size();
+
+    return found;
+}
+
+//The final slot the generated lookup() finds for key in result's tables, and optionally its layer-1 bin
+template<typename KeyType>
+static size_t finalSlot2(const KeyType& key, const SearchResult2& result, size_t* bin = nullptr){
+    size_t h1;
+    size_t slot;
+    if(result.partitions.empty()){
+        h1 = result.n1(hash2(key, result.s0, result.positions));
+        slot = result.n2(hash2(key, result.layer1.bins[h1].seed, result.positions));
+    }else{
+        const Partition* part = &result.partitions[partitionRange(result.partitions.size()-1)(hash2(key, partition_seed, result.positions))];
+        const SlotRange n1 {part[1].seed_start - part->seed_start - 1, result.n2.multiply_shift};
+        const SlotRange n2 {part[1].slot_start - part->slot_start - 1, result.n2.multiply_shift};
+        h1 = part->seed_start + n1(hash2(key, SeedType(part->s0), result.positions));
+        slot = part->slot_start + n2(hash2(key, result.layer1.bins[h1].seed, result.positions));
+    }
+
+    if(bin) *bin = h1;
+    return slot;
+}
+
+template<typename KeyType>
+static bool mapsEveryKey(const std::vector<KeyType>& keys, const SearchResult2& result){
+    for(size_t i = 0; i < keys.size(); i++)
+        if(result.mapping[finalSlot2(keys[i], result)] != int(i)) return false;
+
+    return true;
+}
+
+//The generated hash of a string shorter than the shortest key the positions were selected on returns early
+static inline bool fitsPositions(const std::vector<std::string>& keys, const KeyPositions& positions){
+    if(!positions.active()) return true;
+    for(const std::string& key : keys)
+        if(key.size() < positions.min_size) return false;
+
+    return true;
+}
+
+template<typename KeyType>
+static bool fitsPositions(const std::vector<KeyType>&, const KeyPositions&){
+    return true;
+}
+
+//Matches keys against previous_keys, which previous holds the tables of. Sets remap to the index in keys of
+//each previous key, or -1 for a removed one, and lists the keys that are new. Runs of keys in their previous
+//order are matched by comparison alone; any other key is looked up in the previous tables.
+template<typename KeyType>
+static void diffKeys2(const std::vector<KeyType>& previous_keys,
+                      const SearchResult2& previous,
+                      const std::vector<KeyType>& keys,
+                      std::vector<int>& remap,
+                      std::vector<uint32_t>& added){
+    remap.assign(previous_keys.size(), -1);
+    added.clear();
 
-    for(const KeyType& key : keys){
-        const uint32_t h = hash2(key, seed) & n1;
-        layer1[h].keys.push_back(key);
+    size_t j = 0;
+    for(size_t i = 0; i < keys.size(); i++){
+        if(j < previous_keys.size() && keys[i] == previous_keys[j]){
+            remap[j++] = int(i);
+            continue;
+        }
+
+        const int previous_key = previous.mapping[finalSlot2(keys[i], previous)];
+        if(previous_key == -1 || !(previous_keys[previous_key] == keys[i])){
+            added.push_back(uint32_t(i));
+            continue;
+        }
+        remap[previous_key] = int(i);
+        j = previous_key+1;
     }
+}
 
-    struct LayerSort{
-        inline bool operator() (const Bin<KeyType>& a, const Bin<KeyType>& b){
-            return (a.keys.size() > b.keys.size());
+//The mapping of the previous tables with its keys renumbered by remap, and removed keys' slots emptied
+static std::vector<int> remapSlots(const std::vector<int>& mapping, const std::vector<int>& remap){
+    std::vector<int> remapped(mapping.size());
+    for(size_t slot = 0; slot < mapping.size(); slot++)
+        remapped[slot] = mapping[slot] == -1 ? -1 : remap[mapping[slot]];
+
+    return remapped;
+}
+
+//Seeds the given bins around the keys mapping already holds, the largest first. A bin no seed fits takes the
+//seed whose slots hold the fewest keys of other bins, and the bins holding them are evicted and placed again
+//in turn. An evicted bin never evicts the bin that evicted it. Gives up, returning false, after a number of
+//evictions proportional to the bins given.
+template<typename Keys>
+static bool placeBins2(const Keys& arena,
+                       Layer1& layer1,
+                       const SlotRange& n2,
+                       const std::vector<uint32_t>& bins,
+                       std::vector<int>& mapping,
+                       SearchProgress* progress,
+                       SearchStats& stats){
+    constexpr uint32_t none = std::numeric_limits<uint32_t>::max();
+
+    //Bins to place and the bin that evicted each, if any. The last is placed next, so sorting by size alone
+    //places the largest first with ties broken by the highest layer-1 hash, as a full search does.
+    std::vector<std::pair<uint32_t, uint32_t>> pending;
+    for(const uint32_t& h : bins) pending.push_back({h, none});
+    std::stable_sort(pending.begin(), pending.end(), [&layer1](const std::pair<uint32_t, uint32_t>& a, const std::pair<uint32_t, uint32_t>& b){
+        return layer1.bins[a.first].size < layer1.bins[b.first].size;
+    });
+
+    std::vector<bool> final_layer(n2.size());
+    for(size_t slot = 0; slot < mapping.size(); slot++) final_layer[slot] = mapping[slot] != -1;
+
+    auto slotOf = [&](const Bin& bin, size_t i, SeedType seed){
+        return n2(arena.hash(layer1.order[bin.start+i], seed));
+    };
+    auto setSlots = [&](const Bin& bin, bool occupied){
+        for(size_t i = 0; i < bin.size; i++){
+            const uint32_t slot = slotOf(bin, i, bin.seed);
+            final_layer[slot] = occupied;
+            mapping[slot] = occupied ? int(layer1.order[bin.start+i]) : -1;
         }
     };
-    std::sort(layer1.begin(), layer1.end(), LayerSort());
 
-    const size_t max_keys1 = 10;
+    const std::atomic<size_t> lowest_success(std::numeric_limits<size_t>::max());
+    const SeedTrial trial {lowest_success, 0, progress};
+    const SeedType period = arena.seedPeriod(n2);
+    const size_t max_evictions = 64 + 16*bins.size();
+    size_t evictions = 0;
+
+    while(!pending.empty()){
+        const uint32_t h = pending.back().first;
+        const uint32_t evictor = pending.back().second;
+        pending.pop_back();
+
+        Bin& bin = layer1.bins[h];
+        stats.reseeded_bins++;
+        if(findSeed(arena, layer1, bin, n2, final_layer, trial, stats)){
+            setSlots(bin, true);
+            if(progress) progress->bins_placed.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+        if(trial.cancelled()){
+            stats.cancelled = true;
+            return false;
+        }
+        if(evictions >= max_evictions) return false;
+
+        //The scan starts at a seed that moves with every eviction, so that ties don't keep choosing the same seeds
+        size_t best_cost = std::numeric_limits<size_t>::max();
+        SeedType best_seed = 0;
+        for(size_t s = 0; s < period; s++){
+            const SeedType seed = SeedType((s + evictions*7919) % period);
+            std::array<uint32_t, max_keys1> slots;
+            std::array<uint32_t, max_keys1> owners;
+            size_t num_owners = 0;
+            size_t cost = 0;
+            bool fits = true;
+
+            for(size_t i = 0; i < bin.size && fits; i++){
+                slots[i] = slotOf(bin, i, seed);
+                fits = std::find(slots.begin(), slots.begin()+i, slots[i]) == slots.begin()+i;
+                if(!fits || mapping[slots[i]] == -1) continue;
 
-    if(layer1[0].keys.size() == 1) return true;
-    else if(layer1[0].keys.size() >= max_keys1) return false;
+                const uint32_t owner = layer1.h1[mapping[slots[i]]];
+                if(owner == evictor) fits = false;
+                else if(std::find(owners.begin(), owners.begin()+num_owners, owner) == owners.begin()+num_owners){
+                    owners[num_owners++] = owner;
+                    cost += layer1.bins[owner].size;
+                }
+            }
 
-    std::vector<bool> final_layer(n2+1, false);
+            if(fits && cost < best_cost){
+                best_cost = cost;
+                best_seed = seed;
+            }
+        }
+        if(best_cost == std::numeric_limits<size_t>::max()) return false;
 
-    for(auto& bin : layer1)
-        if(!findSeed<KeyType>(bin, n2, final_layer)) return false;
+        bin.seed = best_seed;
+        for(size_t i = 0; i < bin.size; i++){
+            const int key = mapping[slotOf(bin, i, bin.seed)];
+            if(key == -1) continue;
+
+            const uint32_t owner = layer1.h1[key];
+            setSlots(layer1.bins[owner], false);
+            pending.push_back({owner, h});
+            evictions++;
+            stats.evicted_bins++;
+        }
+        setSlots(bin, true);
+        stats.bins_placed[bin.size]++;
+        if(progress) progress->bins_placed.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    return true;
+}
+
+//Rebuilds a single-table previous, found for previous_keys, for keys on the same s0 and table sizes. Kept keys
+//take their layer-1 hashes and slots from previous, so only new keys are hashed. Only the bins that gained a
+//key are seeded again, since a removed key just leaves its slot empty.
+template<typename KeyType>
+static bool rebuildSeeds2(const SearchResult2& previous,
+                          const KeyRefs<KeyType>& refs,
+                          const std::vector<int>& remap,
+                          const std::vector<uint32_t>& added,
+                          SearchProgress* progress,
+                          SearchResult2& result){
+    result.n1 = previous.n1;
+    result.n2 = previous.n2;
+    result.positions = previous.positions;
+    result.s0 = previous.s0;
+    if(refs.size() > result.n2.size()) return false;
+
+    Layer1& layer1 = result.layer1;
+    layer1.h1.assign(refs.size(), 0);
+    for(size_t j = 0; j < remap.size(); j++)
+        if(remap[j] != -1) layer1.h1[remap[j]] = previous.layer1.h1[j];
+    for(const uint32_t& i : added) layer1.h1[i] = result.n1(refs.hash(i, result.s0));
+
+    layer1.bins.assign(result.n1.size(), Bin());
+    for(const uint32_t& h : layer1.h1) layer1.bins[h].size++;
+    if(!sortLayer1(layer1, 0, result.stats)) return false;
+    for(size_t h = 0; h < layer1.bins.size(); h++) layer1.bins[h].seed = previous.layer1.bins[h].seed;
+
+    std::vector<uint32_t> changed_bins;
+    for(const uint32_t& i : added) changed_bins.push_back(layer1.h1[i]);
+    std::sort(changed_bins.begin(), changed_bins.end());
+    changed_bins.erase(std::unique(changed_bins.begin(), changed_bins.end()), changed_bins.end());
+
+    //The kept keys of changed bins are placed again with the rest of their bin
+    result.mapping = remapSlots(previous.mapping, remap);
+    for(const uint32_t& h : changed_bins){
+        const Bin& bin = layer1.bins[h];
+        for(size_t k = bin.start; k < bin.start + bin.size; k++){
+            const uint32_t slot = result.n2(refs.hash(layer1.order[k], bin.seed));
+            if(result.mapping[slot] == int(layer1.order[k])) result.mapping[slot] = -1;
+        }
+    }
+
+    return placeBins2(refs, layer1, result.n2, changed_bins, result.mapping, progress, result.stats);
+}
+
+//Rebuilds a partitioned previous on the same partitions, each with the same layer-1 bins. A partition no key
+//was added to keeps its tables. One that gained a key is rebuilt on its own, or if that fails, searched again
+//with a new s0 on its own table sizes and then on twice the final slots, as findPartitioned2() does.
+template<typename KeyType>
+static bool rebuildPartitioned2(const SearchResult2& previous,
+                                const std::vector<KeyType>& keys,
+                                const std::vector<int>& remap,
+                                const std::vector<uint32_t>& added,
+                                SearchProgress* progress,
+                                SearchResult2& result){
+    const size_t num_partitions = previous.partitions.size()-1;
+    const SlotRange partition_range = partitionRange(num_partitions);
+    const bool multiply_shift = previous.n2.multiply_shift;
+    result.n1 = previous.n1;
+    result.positions = previous.positions;
+    result.s0 = 0;
+    result.partitions = previous.partitions;
+    result.layer1 = Layer1();
+    result.layer1.bins = previous.layer1.bins;
+    result.layer1.h1.assign(keys.size(), 0);
+    for(size_t j = 0; j < remap.size(); j++){
+        if(remap[j] != -1) result.layer1.h1[remap[j]] = previous.layer1.h1[j];
+        else result.layer1.bins[previous.layer1.h1[j]].size--;
+    }
+
+    const std::vector<int> kept = remapSlots(previous.mapping, remap);
+    std::vector<std::vector<uint32_t>> added_by_partition(num_partitions);
+    for(const uint32_t& i : added)
+        added_by_partition[partition_range(hash2(keys[i], partition_seed, result.positions))].push_back(i);
+
+    result.mapping.clear();
+    for(size_t p = 0; p < num_partitions; p++){
+        const Partition& first = previous.partitions[p];
+        const Partition& last = previous.partitions[p+1];
+        assert(result.mapping.size() <= std::numeric_limits<uint32_t>::max());
+        result.partitions[p].slot_start = uint32_t(result.mapping.size());
+        if(added_by_partition[p].empty()){
+            result.mapping.insert(result.mapping.end(), kept.begin() + first.slot_start, kept.begin() + last.slot_start);
+            continue;
+        }
+        if(progress && progress->cancelled()) return false;
+
+        //The partition's share of the previous tables and of the keys, indexed from 0
+        SearchResult2 part_previous;
+        part_previous.n1 = {last.seed_start - first.seed_start - 1, multiply_shift};
+        part_previous.n2 = {last.slot_start - first.slot_start - 1, multiply_shift};
+        part_previous.positions = previous.positions;
+        part_previous.s0 = SeedType(first.s0);
+        part_previous.layer1.bins.assign(previous.layer1.bins.begin() + first.seed_start, previous.layer1.bins.begin() + last.seed_start);
+
+        std::vector<uint32_t> part_indices;
+        std::vector<int> part_remap;
+        std::vector<uint32_t> part_added;
+        for(uint32_t slot = first.slot_start; slot < last.slot_start; slot++){
+            const int previous_key = previous.mapping[slot];
+            part_previous.mapping.push_back(previous_key == -1 ? -1 : int(part_remap.size()));
+            if(previous_key == -1) continue;
+
+            part_previous.layer1.h1.push_back(previous.layer1.h1[previous_key] - first.seed_start);
+            part_remap.push_back(kept[slot] == -1 ? -1 : int(part_indices.size()));
+            if(kept[slot] != -1) part_indices.push_back(kept[slot]);
+        }
+        for(const uint32_t& i : added_by_partition[p]){
+            part_added.push_back(part_indices.size());
+            part_indices.push_back(i);
+        }
+
+        SearchResult2 part;
+        part.stats.seeds_tried.assign(max_keys1, 0);
+        part.stats.bins_placed.assign(max_keys1, 0);
+        bool found = rebuildSeeds2(part_previous, KeyRefs<KeyType>{keys, previous.positions, &part_indices}, part_remap, part_added, progress, part);
+        if(!found && !part.stats.cancelled){
+            std::vector<KeyType> part_keys;
+            for(const uint32_t& i : part_indices) part_keys.push_back(keys[i]);
+
+            part.stats.researched_partitions++;
+            part.n1 = part_previous.n1;
+            part.n2 = part_previous.n2;
+            found = part_keys.size() <= part.n2.size() && searchSeeds2(part_keys, 1, progress, part);
+            if(!found && !part.stats.cancelled){
+                part.stats.retried_partitions++;
+                part.n2 = {2*part.n2.size()-1, multiply_shift};
+                found = searchSeeds2(part_keys, 1, progress, part);
+            }
+        }
+        result.stats.merge(part.stats);
+        if(!found) return false;
+
+        result.partitions[p].s0 = part.s0;
+        std::copy(part.layer1.bins.begin(), part.layer1.bins.end(), result.layer1.bins.begin() + first.seed_start);
+        for(size_t k = 0; k < part_indices.size(); k++)
+            result.layer1.h1[part_indices[k]] = first.seed_start + part.layer1.h1[k];
+        for(const int& slot : part.mapping)
+            result.mapping.push_back(slot == -1 ? -1 : int(part_indices[slot]));
+    }
+    result.partitions.back().slot_start = uint32_t(result.mapping.size());
+
+    result.n2 = {result.mapping.size()-1, multiply_shift};
+    result.stats.final_slots = result.n2.size();
+
+    return true;
+}
+
+//Finds tables for keys from previous, the tables found for previous_keys, keeping its top-level seeds, table
+//sizes and partitions, so that a small edit to the keys costs a pass over them rather than a search. Returns
+//false when the keys no longer fit the previous tables, for findHash2() to take over: a bin would get
+//max_keys1 keys, there are more keys than slots, a key is shorter than the selected key positions allow,
+//evictions can't place a bin, or previous has a stash, whose keys its bins don't hold.
+template<typename KeyType>
+bool rebuildHash2(const std::vector<KeyType>& previous_keys,
+                  const SearchResult2& previous,
+                  const std::vector<KeyType>& keys,
+                  const SearchOptions& options,
+                  SearchResult2& result){
+    result.stats = SearchStats();
+    result.stats.engine = 2;
+    result.stats.num_keys = keys.size();
+    result.stats.rebuilt = true;
+    result.stats.layer1_bins = previous.n1.size();
+    result.stats.final_slots = previous.n2.size();
+    result.stats.num_partitions = previous.partitions.empty() ? 0 : previous.partitions.size()-1;
+    result.stats.seeds_tried.assign(max_keys1, 0);
+    result.stats.bins_placed.assign(max_keys1, 0);
+
+    if(previous.mapping.empty() || previous.layer1.h1.size() != previous_keys.size() || !previous.stash.empty()) return false;
+    if(keys.size() > previous.mapping.size() || !fitsPositions(keys, previous.positions)) return false;
+
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<int> remap;
+    std::vector<uint32_t> added;
+    diffKeys2(previous_keys, previous, keys, remap, added);
+
+    result.partitions.clear();
+    result.stash.clear();
+    const bool found = previous.partitions.empty() ? rebuildSeeds2(previous, KeyRefs<KeyType>{keys, previous.positions}, remap, added, options.progress, result)
+                                                   : rebuildPartitioned2(previous, keys, remap, added, options.progress, result);
+    result.stats.search_seconds = secondsSince(start);
+    if(options.progress && options.progress->cancelled()) result.stats.cancelled = true;
+    if(!found || result.stats.cancelled) return false;
+
+    result.stats.s0 = result.s0;
+    result.stats.bin_sizes.assign(max_keys1, 0);
+    for(const Bin& bin : result.layer1.bins) result.stats.bin_sizes[bin.size]++;
+    assert(mapsEveryKey(keys, result));
 
-    writeHash2<KeyType>(keys, seed, n1, n2, vals, layer1, hash_str, map_name, default_value, nonKeyLookups);
     return true;
 }
 
@@ -216,27 +1408,63 @@ bool hashSearch2(const std::vector<KeyType>& keys,
                  std::string default_value = "",
                  uint8_t expansion = 1,
                  uint8_t reduction = 1,
-                 bool nonKeyLookups = true){
+                 bool nonKeyLookups = true,
+                 const SearchOptions& options = SearchOptions(),
+                 SearchStats* stats = nullptr){
     assert(keys.size() > 1);
     assert(!hasDuplicates(keys));
     assert(vals.size() == keys.size());
 
-    const size_t n1 = getModulusBitmask(keys.size()*expansion/reduction);
-    const size_t n2 = getModulusBitmask(keys.size());
+    SearchResult2 result;
+    if(!findHash2(keys, expansion, reduction, options, result)){
+        if(stats) *stats = result.stats;
+        return false;
+    }
 
-    const uint8_t primes[32] = {  0,   1,   2,   3,   5,
-                                  7,  11,  13,  17,  19,
-                                 23,  29,  31,  37,  41,
-                                 43,  47,  53,  59,  61,
-                                 67,  71,  73,  79,  83,
-                                 89,  97, 101, 103, 107,
-                                109, 113};
+    const auto start = std::chrono::steady_clock::now();
+    writeHash2<KeyType>(keys, vals, result, hash_str, map_name, default_value, nonKeyLookups, options, &result.stats.table_bytes);
+    result.stats.generate_seconds = secondsSince(start);
+    if(stats) *stats = result.stats;
 
-    for(SeedType seed = 0; seed < 32; seed++)
-        if(testSeed<KeyType>(keys, primes[seed], n1, n2, vals, hash_str, map_name, default_value, nonKeyLookups))
-            return true;
+    return true;
+}
 
-    return false;
+//hashSearch2() for keys after an edit to previous_keys, whose tables state holds. Rebuilds them with
+//rebuildHash2() when it can, and searches as hashSearch2() does when it can't or when state is empty, as it is
+//before the first call. On success state holds the new tables for the next edit; expansion and reduction only
+//apply to a full search.
+template<typename KeyType>
+bool hashRebuild2(const std::vector<KeyType>& previous_keys,
+                  SearchResult2& state,
+                  const std::vector<KeyType>& keys,
+                  const std::vector<std::string>& vals,
+                  std::string& hash_str,
+                  std::string map_name = "PoifectMap",
+                  std::string default_value = "",
+                  uint8_t expansion = 1,
+                  uint8_t reduction = 1,
+                  bool nonKeyLookups = true,
+                  const SearchOptions& options = SearchOptions(),
+                  SearchStats* stats = nullptr){
+    assert(keys.size() > 1);
+    assert(!hasDuplicates(keys));
+    assert(vals.size() == keys.size());
+
+    SearchResult2 result;
+    bool found = !state.mapping.empty() && rebuildHash2(previous_keys, state, keys, options, result);
+    if(!found && !result.stats.cancelled) found = findHash2(keys, expansion, reduction, options, result);
+    if(!found){
+        if(stats) *stats = result.stats;
+        return false;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    writeHash2<KeyType>(keys, vals, result, hash_str, map_name, default_value, nonKeyLookups, options, &result.stats.table_bytes);
+    result.stats.generate_seconds = secondsSince(start);
+    if(stats) *stats = result.stats;
+    state = std::move(result);
+
+    return true;
 }
 
 #endif // HASHSEARCH2_H
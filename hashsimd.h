@@ -0,0 +1,137 @@
+#ifndef HASHSIMD_H
+#define HASHSIMD_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+//GCC and Clang compile every x86 kernel through target attributes and pick one for the running CPU,
+//so a portable build still uses the widest vectors available. Other compilers get the kernel for
+//the instruction set the build targets, if any.
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define POIFECT_SIMD_DISPATCH 1
+#define POIFECT_TARGET(isa) __attribute__((target(isa)))
+#define POIFECT_SIMD_AVX512 1
+#define POIFECT_SIMD_AVX2 1
+#define POIFECT_SIMD_SSE41 1
+#else
+#define POIFECT_SIMD_DISPATCH 0
+#define POIFECT_TARGET(isa)
+#if defined(__AVX512F__)
+#include <immintrin.h>
+#define POIFECT_SIMD_AVX512 1
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#define POIFECT_SIMD_AVX2 1
+#elif defined(__SSE4_1__)
+#include <smmintrin.h>
+#define POIFECT_SIMD_SSE41 1
+#endif
+#endif
+
+//Keys are hashed in blocks of this size, whatever the vector width
+constexpr size_t hash_block = 16;
+
+//Hashes hash_block keys with the hashSearch() mixer and masks them with n
+typedef void (*HashBlockKernel)(const uint32_t* keys, uint32_t* slots, const std::array<uint32_t, 6>& c, uint32_t n);
+
+//Vector form of the hashSearch() mixer, stamped out once per instruction set from that set's helpers.
+//Shift counts are read from a register, so one kernel serves every candidate.
+#define POIFECT_HASH_BLOCK_KERNEL(isa) \
+    POIFECT_TARGET(isa) static inline void hashBlock(const uint32_t* keys, uint32_t* slots, const std::array<uint32_t, 6>& c, uint32_t n){ \
+        const Vec c0 = set1(c[0]); \
+        const Vec c4 = set1(c[4]+1); \
+        const Vec mask = set1(n); \
+        const __m128i c1 = _mm_cvtsi32_si128(c[1]); \
+        const __m128i c2 = _mm_cvtsi32_si128(c[2]); \
+        const __m128i c3 = _mm_cvtsi32_si128(c[3]); \
+        const __m128i c5 = _mm_cvtsi32_si128(c[5]); \
+        \
+        for(size_t i = 0; i < hash_block; i += width){ \
+            Vec a = load(keys + i); \
+            a = bitXor(bitXor(a, c0), shiftRight(a, c1)); \
+            if(c[2]) a = add(a, shiftLeft(a, c2)); \
+            if(c[3]) a = bitXor(a, shiftRight(a, c3)); \
+            if(c[4]) a = mul(a, c4); \
+            if(c[5]) a = bitXor(a, shiftRight(a, c5)); \
+            store(slots + i, bitAnd(a, mask)); \
+        } \
+    }
+
+namespace simd {
+
+#ifdef POIFECT_SIMD_AVX512
+namespace avx512 {
+constexpr size_t width = 16;
+typedef __m512i Vec;
+POIFECT_TARGET("avx512f") static inline Vec set1(uint32_t x){ return _mm512_set1_epi32(x); }
+POIFECT_TARGET("avx512f") static inline Vec load(const uint32_t* p){ return _mm512_loadu_si512(p); }
+POIFECT_TARGET("avx512f") static inline void store(uint32_t* p, Vec a){ _mm512_storeu_si512(p, a); }
+POIFECT_TARGET("avx512f") static inline Vec bitXor(Vec a, Vec b){ return _mm512_xor_si512(a, b); }
+POIFECT_TARGET("avx512f") static inline Vec bitAnd(Vec a, Vec b){ return _mm512_and_si512(a, b); }
+POIFECT_TARGET("avx512f") static inline Vec add(Vec a, Vec b){ return _mm512_add_epi32(a, b); }
+POIFECT_TARGET("avx512f") static inline Vec mul(Vec a, Vec b){ return _mm512_mullo_epi32(a, b); }
+//The unmasked shifts merge into _mm512_undefined_epi32(), which GCC flags as maybe-uninitialized
+POIFECT_TARGET("avx512f") static inline Vec shiftLeft(Vec a, __m128i count){ return _mm512_maskz_sll_epi32(0xFFFF, a, count); }
+POIFECT_TARGET("avx512f") static inline Vec shiftRight(Vec a, __m128i count){ return _mm512_maskz_srl_epi32(0xFFFF, a, count); }
+POIFECT_HASH_BLOCK_KERNEL("avx512f")
+}
+#endif
+
+#ifdef POIFECT_SIMD_AVX2
+namespace avx2 {
+constexpr size_t width = 8;
+typedef __m256i Vec;
+POIFECT_TARGET("avx2") static inline Vec set1(uint32_t x){ return _mm256_set1_epi32(x); }
+POIFECT_TARGET("avx2") static inline Vec load(const uint32_t* p){ return _mm256_loadu_si256(reinterpret_cast<const Vec*>(p)); }
+POIFECT_TARGET("avx2") static inline void store(uint32_t* p, Vec a){ _mm256_storeu_si256(reinterpret_cast<Vec*>(p), a); }
+POIFECT_TARGET("avx2") static inline Vec bitXor(Vec a, Vec b){ return _mm256_xor_si256(a, b); }
+POIFECT_TARGET("avx2") static inline Vec bitAnd(Vec a, Vec b){ return _mm256_and_si256(a, b); }
+POIFECT_TARGET("avx2") static inline Vec add(Vec a, Vec b){ return _mm256_add_epi32(a, b); }
+POIFECT_TARGET("avx2") static inline Vec mul(Vec a, Vec b){ return _mm256_mullo_epi32(a, b); }
+POIFECT_TARGET("avx2") static inline Vec shiftLeft(Vec a, __m128i count){ return _mm256_sll_epi32(a, count); }
+POIFECT_TARGET("avx2") static inline Vec shiftRight(Vec a, __m128i count){ return _mm256_srl_epi32(a, count); }
+POIFECT_HASH_BLOCK_KERNEL("avx2")
+}
+#endif
+
+#ifdef POIFECT_SIMD_SSE41
+namespace sse41 {
+constexpr size_t width = 4;
+typedef __m128i Vec;
+POIFECT_TARGET("sse4.1") static inline Vec set1(uint32_t x){ return _mm_set1_epi32(x); }
+POIFECT_TARGET("sse4.1") static inline Vec load(const uint32_t* p){ return _mm_loadu_si128(reinterpret_cast<const Vec*>(p)); }
+POIFECT_TARGET("sse4.1") static inline void store(uint32_t* p, Vec a){ _mm_storeu_si128(reinterpret_cast<Vec*>(p), a); }
+POIFECT_TARGET("sse4.1") static inline Vec bitXor(Vec a, Vec b){ return _mm_xor_si128(a, b); }
+POIFECT_TARGET("sse4.1") static inline Vec bitAnd(Vec a, Vec b){ return _mm_and_si128(a, b); }
+POIFECT_TARGET("sse4.1") static inline Vec add(Vec a, Vec b){ return _mm_add_epi32(a, b); }
+POIFECT_TARGET("sse4.1") static inline Vec mul(Vec a, Vec b){ return _mm_mullo_epi32(a, b); }
+POIFECT_TARGET("sse4.1") static inline Vec shiftLeft(Vec a, __m128i count){ return _mm_sll_epi32(a, count); }
+POIFECT_TARGET("sse4.1") static inline Vec shiftRight(Vec a, __m128i count){ return _mm_srl_epi32(a, count); }
+POIFECT_HASH_BLOCK_KERNEL("sse4.1")
+}
+#endif
+
+}
+
+//The widest kernel the running CPU supports, or nullptr to hash with the scalar mixer
+static inline HashBlockKernel hashBlockKernel(){
+    #if POIFECT_SIMD_DISPATCH
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512f")) return simd::avx512::hashBlock;
+    if(__builtin_cpu_supports("avx2")) return simd::avx2::hashBlock;
+    if(__builtin_cpu_supports("sse4.1")) return simd::sse41::hashBlock;
+    return nullptr;
+    #elif defined(POIFECT_SIMD_AVX512)
+    return simd::avx512::hashBlock;
+    #elif defined(POIFECT_SIMD_AVX2)
+    return simd::avx2::hashBlock;
+    #elif defined(POIFECT_SIMD_SSE41)
+    return simd::sse41::hashBlock;
+    #else
+    return nullptr;
+    #endif
+}
+
+#endif // HASHSIMD_H
@@ -0,0 +1,235 @@
+#ifndef HASHTUNER_H
+#define HASHTUNER_H
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <limits>
+#include <memory>
+#include <set>
+#include <string>
+#include <tuple>
+#include <vector>
+#include "hashbenchmark.h"
+#include "hashruntime.h"
+
+//Sweeps engines, expansion/reduction, multiply-shift reduction and load factors over a key set. Each candidate
+//is searched once, and its tables are generated to count their bytes and loaded into a PoifectRuntimeMap to time
+//its lookups. The map runs the same hashes over the same table sizes as the header would, so the timings rank
+//candidates without compiling them. The layout options (compact_seeds, interleave_slots), key_positions and
+//partition_size are taken from the base options as given.
+
+//The tables a candidate's search found. Only the result for its engine is set.
+struct TunedTables{
+    SearchResult result;
+    SearchResult2 result2;
+};
+
+struct TunedConfig{
+    uint8_t engine = 2;
+    uint8_t expansion = 1;
+    uint8_t reduction = 1;
+    SearchOptions options;
+    size_t table_bytes = 0;
+    double lookup_ns = 0;
+    double p99_ns = 0;
+    bool pareto = false; //No other candidate is both smaller and faster
+
+    //Kept while no other candidate is as small and as fast, which bestConfig()'s pick never is, so the
+    //configuration picked can be generated without searching again
+    std::shared_ptr<const TunedTables> tables;
+
+    //The PoifectCli flags for this configuration
+    std::string args() const{
+        std::string str = "--engine " + std::to_string(engine) + " -e " + std::to_string(expansion) + " -r " + std::to_string(reduction);
+        if(options.multiply_shift) str += " --multiply-shift";
+        if(options.load_factor != 1.0){
+            char buffer[32];
+            std::snprintf(buffer, sizeof(buffer), " --load-factor %g", options.load_factor);
+            str += buffer;
+        }
+
+        return str;
+    }
+};
+
+//Candidates in the order they are tried. hashSearch() is only swept for key sets up to max_engine1_keys,
+//since its coefficient search grows fastest with the key count.
+static std::vector<TunedConfig> tuningCandidates(size_t num_keys, const SearchOptions& base, size_t max_engine1_keys){
+    std::vector<TunedConfig> candidates;
+    std::set<std::tuple<uint8_t, size_t, size_t, bool>> sizes;
+
+    auto add = [&](uint8_t engine, uint8_t expansion, uint8_t reduction, bool multiply_shift, double load_factor){
+        TunedConfig config;
+        config.engine = engine;
+        config.expansion = expansion;
+        config.reduction = reduction;
+        config.options = base;
+        config.options.multiply_shift = multiply_shift;
+        config.options.load_factor = load_factor;
+
+        //Power-of-two rounding makes several candidates the same tables
+        const SlotRange n1 = getSlotRange(num_keys*expansion/double(reduction), config.options);
+        const SlotRange n2 = engine == 1 ? getSlotRange(num_keys*expansion/double(reduction)/load_factor, config.options)
+                                         : getSlotRange(num_keys/load_factor, config.options);
+        if(sizes.insert({engine, engine == 1 ? 0 : n1.size(), n2.size(), multiply_shift}).second) candidates.push_back(config);
+    };
+
+    if(num_keys <= max_engine1_keys){
+        for(uint8_t expansion = 1; expansion <= 4; expansion++){
+            add(1, expansion, 1, false, 1.0);
+            add(1, expansion, 1, true, 1.0);
+        }
+    }
+
+    const std::pair<uint8_t, uint8_t> layer1_sizes[] = {{2, 1}, {1, 1}, {1, 2}, {1, 4}, {1, 6}};
+    for(const auto& layer1 : layer1_sizes){
+        for(double load_factor : {1.0, 0.5})
+            add(2, layer1.first, layer1.second, false, load_factor);
+        for(double load_factor : {1.0, 0.85, 0.7})
+            add(2, layer1.first, layer1.second, true, load_factor);
+    }
+
+    return candidates;
+}
+
+//Flags the candidates no other candidate beats on both table bytes and lookup time
+static void markPareto(std::vector<TunedConfig>& configs){
+    //Stable, so that of equal candidates the first found, which kept its tables, comes first
+    std::stable_sort(configs.begin(), configs.end(), [](const TunedConfig& a, const TunedConfig& b){
+        return std::make_pair(a.table_bytes, a.lookup_ns) < std::make_pair(b.table_bytes, b.lookup_ns);
+    });
+
+    double fastest = std::numeric_limits<double>::max();
+    for(TunedConfig& config : configs){
+        config.pareto = config.lookup_ns < fastest;
+        fastest = std::min(fastest, config.lookup_ns);
+    }
+}
+
+//Returns every candidate found, sorted by table bytes, with the Pareto front flagged. queries should look
+//like production lookups; they are repeated until there are at least min_queries of them so that short
+//samples still time reliably. Returns an empty list if no candidate finds a hash.
+template<typename KeyType>
+std::vector<TunedConfig> tuneMap(const std::vector<KeyType>& keys,
+                                 const std::vector<std::string>& vals,
+                                 const std::vector<typename PoifectRuntimeMap<KeyType>::Query>& queries,
+                                 const std::string& default_value = "",
+                                 bool nonKeyLookups = true,
+                                 const SearchOptions& base = SearchOptions(),
+                                 size_t min_queries = 100000,
+                                 size_t repetitions = 3,
+                                 size_t max_engine1_keys = 2000){
+    assert(!queries.empty());
+    typedef typename PoifectRuntimeMap<KeyType>::Query Query;
+
+    std::vector<Query> timed;
+    while(timed.size() < min_queries) timed.insert(timed.end(), queries.begin(), queries.end());
+
+    std::vector<TunedConfig> configs;
+    for(TunedConfig config : tuningCandidates(keys.size(), base, max_engine1_keys)){
+        const std::shared_ptr<TunedTables> tables = std::make_shared<TunedTables>();
+        std::string hash_str;
+        PoifectRuntimeMap<KeyType> map;
+        if(config.engine == 1){
+            if(!findHash(keys, config.expansion, config.reduction, config.options, tables->result)) continue;
+            writeHash<KeyType>(keys, vals, tables->result, hash_str, "PoifectTuned", default_value, nonKeyLookups, config.options, &config.table_bytes);
+            if(!map.build(keys, vals, tables->result, default_value)) continue;
+        }else{
+            if(!findHash2(keys, config.expansion, config.reduction, config.options, tables->result2)) continue;
+            writeHash2<KeyType>(keys, vals, tables->result2, hash_str, "PoifectTuned", default_value, nonKeyLookups, config.options, &config.table_bytes);
+            if(!map.build(keys, vals, tables->result2, default_value)) continue;
+        }
+
+        const BenchmarkResult timing = benchmarkLookups(timed, [&map](const Query& key){ return map.lookup(key); }, repetitions);
+        config.lookup_ns = timing.mean_ns;
+        config.p99_ns = timing.p99_ns;
+
+        //A candidate another is as small and as fast as can't be picked, so only the others keep their tables
+        bool dominated = false;
+        for(TunedConfig& other : configs){
+            if(!other.tables) continue;
+            if(other.table_bytes <= config.table_bytes && other.lookup_ns <= config.lookup_ns) dominated = true;
+            else if(config.table_bytes <= other.table_bytes && config.lookup_ns <= other.lookup_ns) other.tables.reset();
+        }
+        if(!dominated) config.tables = tables;
+        configs.push_back(config);
+    }
+
+    markPareto(configs);
+    return configs;
+}
+
+//The configuration to generate from a tuneMap() list: among those whose tables fit in memory_budget bytes (0
+//for no limit), the smallest within tolerance of the fastest, so timing noise doesn't buy a larger table.
+//Returns false if none fits.
+static bool bestConfig(const std::vector<TunedConfig>& configs, TunedConfig& best, size_t memory_budget = 0, double tolerance = 0.05){
+    double fastest = std::numeric_limits<double>::max();
+    for(const TunedConfig& config : configs)
+        if(!memory_budget || config.table_bytes <= memory_budget) fastest = std::min(fastest, config.lookup_ns);
+    if(fastest == std::numeric_limits<double>::max()) return false;
+
+    //configs is sorted by table bytes, so the first one within tolerance is the smallest
+    for(const TunedConfig& config : configs){
+        if(memory_budget && config.table_bytes > memory_budget) continue;
+        if(config.lookup_ns <= fastest * (1.0 + tolerance)){
+            best = config;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+//Generates the header for a tuneMap() configuration from the tables it kept, with the stats of its search.
+//Returns false if it kept none, for the caller to search again.
+template<typename KeyType>
+bool writeTuned(const std::vector<KeyType>& keys,
+                const std::vector<std::string>& vals,
+                const TunedConfig& config,
+                std::string& hash_str,
+                const std::string& map_name,
+                const std::string& default_value,
+                bool nonKeyLookups,
+                SearchStats* stats = nullptr){
+    if(!config.tables) return false;
+
+    const auto start = std::chrono::steady_clock::now();
+    SearchStats found = config.engine == 1 ? config.tables->result.stats : config.tables->result2.stats;
+    if(config.engine == 1) writeHash<KeyType>(keys, vals, config.tables->result, hash_str, map_name, default_value, nonKeyLookups, config.options, &found.table_bytes);
+    else writeHash2<KeyType>(keys, vals, config.tables->result2, hash_str, map_name, default_value, nonKeyLookups, config.options, &found.table_bytes);
+    found.generate_seconds = secondsSince(start);
+    if(stats) *stats = found;
+
+    return true;
+}
+
+//Loads a tuneMap() configuration's kept tables into map. Returns false if it kept none.
+template<typename KeyType>
+bool buildTuned(PoifectRuntimeMap<KeyType>& map,
+                const std::vector<KeyType>& keys,
+                const std::vector<std::string>& vals,
+                const TunedConfig& config,
+                const std::string& default_value,
+                SearchStats* stats = nullptr){
+    if(!config.tables) return false;
+    if(stats) *stats = config.engine == 1 ? config.tables->result.stats : config.tables->result2.stats;
+
+    return config.engine == 1 ? map.build(keys, vals, config.tables->result, default_value)
+                              : map.build(keys, vals, config.tables->result2, default_value);
+}
+
+//One line per candidate, Pareto-front candidates starred
+static std::string tuningTable(const std::vector<TunedConfig>& configs){
+    char buffer[160];
+    std::string str = "   table bytes  lookup ns   p99 ns  configuration\n";
+    for(const TunedConfig& config : configs){
+        std::snprintf(buffer, sizeof(buffer), "%c %12zu %10.2f %8.2f  ", config.pareto ? '*' : ' ',
+                      config.table_bytes, config.lookup_ns, config.p99_ns);
+        str += buffer + config.args() + "\n";
+    }
+
+    return str;
+}
+
+#endif // HASHTUNER_H
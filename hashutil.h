@@ -2,35 +2,389 @@
 #define HASHUTIL_H
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <functional>
 #include <limits>
 #include <string>
+#include <thread>
+#include <utility>
 #include <vector>
+#include "hashoptions.h"
 
 constexpr int entries_per_row = 10;
 
+static inline double secondsSince(std::chrono::steady_clock::time_point start){
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static inline unsigned numThreads(const SearchOptions& options){
+    if(options.num_threads) return options.num_threads;
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+//Maps 32-bit hashes onto the slots 0..n. Power-of-two tables keep the low bits. Otherwise the hash is
+//scrambled with a Fibonacci multiply and the high half of its product with the table size is taken.
+struct SlotRange{
+    size_t n;
+    bool multiply_shift;
+
+    size_t size() const{
+        return n+1;
+    }
+
+    uint32_t operator()(uint32_t h) const{
+        if(!multiply_shift) return h & n;
+        return (uint64_t(uint32_t(h * 2654435769u)) * size()) >> 32;
+    }
+
+    std::string str(const std::string& h) const{
+        if(!multiply_shift) return h + " & " + std::to_string(n);
+        return "(uint64_t(uint32_t(" + h + " * 2654435769u)) * " + std::to_string(size()) + ") >> 32";
+    }
+
+    //The reduction onto a table whose size is only known when the generated code runs
+    std::string sizedStr(const std::string& h, const std::string& size) const{
+        if(!multiply_shift) return h + " & (" + size + " - 1)";
+        return "(uint64_t(uint32_t(" + h + " * 2654435769u)) * " + size + ") >> 32";
+    }
+
+    //AVX2 statements reducing the eight 32-bit hashes in var in place
+    std::string simdStr(const std::string& var, const std::string& indent) const{
+        if(!multiply_shift) return indent + var + " = _mm256_and_si256(" + var + ", _mm256_set1_epi32(" + std::to_string(n) + "));\n";
+        const std::string size_vec = "_mm256_set1_epi32(" + std::to_string(size()) + ")";
+        return indent + var + " = _mm256_mullo_epi32(" + var + ", _mm256_set1_epi32(int(2654435769u)));\n"
+             + indent + var + " = _mm256_blend_epi32(_mm256_srli_epi64(_mm256_mul_epu32(" + var + ", " + size_vec + "), 32),\n"
+             + indent + "                        _mm256_mul_epu32(_mm256_srli_epi64(" + var + ", 32), " + size_vec + "), 0xAA);\n";
+    }
+
+    //The same for four hashes held in the low halves of 64-bit lanes
+    std::string simd64Str(const std::string& var, const std::string& indent) const{
+        if(!multiply_shift) return indent + var + " = _mm256_and_si256(" + var + ", _mm256_set1_epi64x(" + std::to_string(n) + "));\n";
+        return indent + var + " = _mm256_mul_epu32(" + var + ", _mm256_set1_epi64x(2654435769u));\n"
+             + indent + var + " = _mm256_srli_epi64(_mm256_mul_epu32(" + var + ", _mm256_set1_epi64x(" + std::to_string(size()) + ")), 32);\n";
+    }
+};
+
+//Finds two equal keys in O(n log n) by sorting (hash, index) pairs, comparing only keys whose hashes match, so
+//large key sets are checked without a string comparison per sort step. first is the earlier index.
 template<typename KeyType>
-static bool hasDuplicates(const std::vector<KeyType>& keys){
-    for(size_t i = keys.size()-1; i < std::numeric_limits<size_t>::max(); i--)
-        for(size_t j = i-1; j < std::numeric_limits<size_t>::max(); j--)
-            if(keys[i] == keys[j]) return true;
+static bool findDuplicate(const std::vector<KeyType>& keys, size_t& first, size_t& second){
+    std::vector<std::pair<size_t, size_t>> order;
+    order.reserve(keys.size());
+    for(size_t i = 0; i < keys.size(); i++) order.emplace_back(std::hash<KeyType>()(keys[i]), i);
+    std::sort(order.begin(), order.end());
+
+    for(size_t run = 0, end; run < order.size(); run = end){
+        for(end = run+1; end < order.size() && order[end].first == order[run].first; end++){
+            for(size_t i = run; i < end; i++){
+                if(keys[order[i].second] == keys[order[end].second]){
+                    first = order[i].second;
+                    second = order[end].second;
+                    return true;
+                }
+            }
+        }
+    }
 
     return false;
 }
 
+template<typename KeyType>
+static bool hasDuplicates(const std::vector<KeyType>& keys){
+    size_t first, second;
+    return findDuplicate(keys, first, second);
+}
+
 size_t getModulusBitmask(size_t size){
     assert(size > 1);
 
     for(size_t i = 1; i < 64; i++)
-        if((1 << i) >= size) return (1 << i) - 1;
+        if((size_t(1) << i) >= size) return (size_t(1) << i) - 1;
 
     return std::numeric_limits<size_t>::max();
 }
 
-void writeKeys(std::string& str,
-               const std::vector<std::string>& keys,
-               const std::vector<int>& mapping,
-               size_t n){
+//A per-slot table of the generated class, stored in the narrowest type that fits its values
+struct SlotField{
+    std::string name;
+    std::string type;
+    std::vector<std::string> values;
+};
+
+std::string uintType(size_t max_value){
+    if(max_value <= std::numeric_limits<uint8_t>::max()) return "uint8_t";
+    if(max_value <= std::numeric_limits<uint16_t>::max()) return "uint16_t";
+    if(max_value <= std::numeric_limits<uint32_t>::max()) return "uint32_t";
+    return "uint64_t";
+}
+
+size_t typeSize(const std::string& type){
+    if(type == "uint8_t") return 1;
+    if(type == "uint16_t") return 2;
+    if(type == "uint32_t") return 4;
+    return 8;
+}
+
+SlotField makeField(std::string name, const std::vector<size_t>& values){
+    SlotField field {name, uintType(*std::max_element(values.begin(), values.end())), {}};
+    for(size_t val : values) field.values.push_back(std::to_string(val));
+
+    return field;
+}
+
+//Name of the slot struct member holding the field stored in the named array
+std::string slotMember(const std::string& name){
+    return name == "keys" ? "key" : name;
+}
+
+std::string slotRef(const std::string& name, const std::string& index, bool interleaved){
+    if(interleaved) return "slots[" + index + "]." + slotMember(name);
+    else return name + "[" + index + "]";
+}
+
+std::string valueStr(const std::string& index, bool interleaved){
+    return "std::string_view(&flat_vals[" + slotRef("val_start", index, interleaved) + "], "
+           + slotRef("val_size", index, interleaved) + ")";
+}
+
+//Length of the UTF-8 sequence starting at str[i], or 0 if it isn't a complete one
+size_t utf8Length(const std::string& str, size_t i){
+    const unsigned char lead = str[i];
+    const size_t length = lead >= 0xC2 && lead < 0xE0 ? 2 : lead >= 0xE0 && lead < 0xF0 ? 3 : lead >= 0xF0 && lead < 0xF5 ? 4 : 0;
+    if(length == 0 || i + length > str.size()) return 0;
+    for(size_t j = 1; j < length; j++)
+        if((static_cast<unsigned char>(str[i+j]) & 0xC0) != 0x80) return 0;
+    return length;
+}
+
+//A C++ literal of str's bytes between quote characters. Quotes, backslashes and control characters are escaped,
+//as are bytes outside a UTF-8 sequence, and every non-ASCII byte of a char literal since it holds only one.
+std::string literalStr(const std::string& str, char quote = '"'){
+    std::string escaped(1, quote);
+    for(size_t i = 0; i < str.size(); i++){
+        const unsigned char ch = str[i];
+        const size_t length = quote == '"' && ch >= 0x80 ? utf8Length(str, i) : 0;
+        if(ch == quote || ch == '\\'){
+            escaped += '\\';
+            escaped += char(ch);
+        }else if(ch == '\n'){
+            escaped += "\\n";
+        }else if(ch >= 0x20 && ch < 0x7F){
+            escaped += char(ch);
+        }else if(length){
+            escaped.append(str, i, length);
+            i += length-1;
+        }else{
+            //Three octal digits, so a digit after the escape isn't read into it
+            char octal[5];
+            std::snprintf(octal, sizeof(octal), "\\%03o", unsigned(ch));
+            escaped += octal;
+        }
+    }
+    return escaped + quote;
+}
+
+//A std::string_view expression of str. Literals stop at a null character, so one holding any gets its size.
+std::string viewStr(const std::string& str){
+    if(str.find('\0') == std::string::npos) return literalStr(str);
+    return "std::string_view(" + literalStr(str) + ", " + std::to_string(str.size()) + ")";
+}
+
+//The value of a query whose own slot holds another key: the default, or whatever a scan of the stash finds
+std::string missStr(const std::string& key, const std::string& default_value, bool stashed){
+    return stashed ? "lookupStash(" + key + ")" : viewStr(default_value);
+}
+
+//The mapping of a table with the stashed keys in slots after its end
+std::vector<int> stashedMapping(const std::vector<int>& mapping, const std::vector<uint32_t>& stash){
+    std::vector<int> stashed(mapping);
+    for(const uint32_t& key : stash) stashed.push_back(int(key));
+    return stashed;
+}
+
+//Writes each field as its own array, or interleaves them into one record per slot so that a hit
+//reads its metadata from a single cache line. Returns the bytes written.
+size_t writeSlots(std::string& str, std::vector<SlotField> fields, bool interleaved){
+    if(fields.empty()) return 0;
+    const size_t num_slots = fields[0].values.size();
+    size_t bytes = 0;
+
+    if(!interleaved){
+        for(const SlotField& field : fields){
+            bytes += typeSize(field.type) * num_slots;
+            str += "    static constexpr std::array<" + field.type + ", " + std::to_string(num_slots) + "> "
+                   + field.name + " {\n        ";
+            for(size_t i = 0; i < num_slots; i++){
+                if(i && i%entries_per_row == 0) str += "\n        ";
+                str += field.values[i] + ",";
+            }
+            str += "\n    };\n\n";
+        }
+
+        return bytes;
+    }
+
+    std::stable_sort(fields.begin(), fields.end(), [](const SlotField& a, const SlotField& b){
+        return typeSize(a.type) > typeSize(b.type);
+    });
+
+    //Largest fields first leaves no padding but at the end, up to the alignment of the first
+    str += "    struct Slot{\n";
+    for(const SlotField& field : fields){
+        str += "        " + field.type + " " + slotMember(field.name) + ";\n";
+        bytes += typeSize(field.type);
+    }
+    str += "    };\n\n";
+    const size_t alignment = typeSize(fields[0].type);
+
+    str += "    static constexpr std::array<Slot, " + std::to_string(num_slots) + "> slots {{\n";
+    for(size_t i = 0; i < num_slots; i++){
+        str += "        {";
+        for(const SlotField& field : fields)
+            str += field.values[i] + ",";
+        str.back() = '}';
+        str += ",\n";
+    }
+    str += "    }};\n\n";
+
+    return (bytes + alignment - 1) / alignment * alignment * num_slots;
+}
+
+//Table for count keys. Multiply-shift tables round count up. Power-of-two tables truncate it, as the integer
+//division they were sized with before multiply_shift did, so that their sizes and headers don't change.
+SlotRange getSlotRange(double count, const SearchOptions& options){
+    if(!options.multiply_shift) return {getModulusBitmask(std::max<size_t>(size_t(count), 2)), false};
+    return {std::max<size_t>(std::ceil(count), 2) - 1, true};
+}
+
+//Character positions that tell a string key set apart, in the style of gperf. Positions from 0 count from the
+//start of the key and negative positions from its end, so -1 is the last character. A position past the end of
+//a key reads as 0. Every key is at least min_size long, so positions within that are read unconditionally.
+struct KeyPositions{
+    std::vector<int> positions;
+    bool use_size = false;
+    size_t min_size = 0;
+
+    bool active() const{
+        return !positions.empty() || use_size;
+    }
+
+    static size_t reach(int pos){
+        return pos >= 0 ? pos+1 : -pos;
+    }
+
+    static char at(const char* key, size_t size, int pos){
+        if(size < reach(pos)) return 0;
+        return pos >= 0 ? key[pos] : key[size + pos];
+    }
+
+    std::string str(int pos) const{
+        const std::string read = pos >= 0 ? "key[" + std::to_string(pos) + "]"
+                                          : "key[key.size()-" + std::to_string(-pos) + "]";
+        if(reach(pos) <= min_size) return read;
+        return "(key.size() >= " + std::to_string(reach(pos)) + " ? " + read + " : 0)";
+    }
+};
+
+//Splits each class of keys by the character at pos, or by length for the length candidate, and renumbers the
+//classes. Returns the number of classes.
+static size_t refineClasses(const std::vector<std::string>& keys, int pos, bool size_feature, std::vector<uint32_t>& classes){
+    std::vector<uint64_t> tagged(keys.size());
+    for(size_t i = 0; i < keys.size(); i++){
+        const uint64_t feature = size_feature ? keys[i].size()
+                                              : uint8_t(KeyPositions::at(keys[i].data(), keys[i].size(), pos));
+        tagged[i] = (uint64_t(classes[i]) << 32) | feature;
+    }
+
+    std::vector<uint64_t> distinct = tagged;
+    std::sort(distinct.begin(), distinct.end());
+    distinct.erase(std::unique(distinct.begin(), distinct.end()), distinct.end());
+    for(size_t i = 0; i < keys.size(); i++)
+        classes[i] = std::lower_bound(distinct.begin(), distinct.end(), tagged[i]) - distinct.begin();
+
+    return distinct.size();
+}
+
+//Greedily adds the position, or the length, that separates the most keys until every key is distinct, then
+//drops any choice the others make redundant. Candidates are the first and last max_positions characters.
+//Returns an inactive selection when they can't separate the keys.
+KeyPositions selectKeyPositions(const std::vector<std::string>& keys){
+    constexpr size_t max_positions = 32;
+
+    size_t min = std::numeric_limits<size_t>::max();
+    size_t max = 0;
+    for(const std::string& key : keys){
+        min = std::min(key.size(), min);
+        max = std::max(key.size(), max);
+    }
+
+    //The last candidate stands for the length. End positions repeat the start ones when all lengths match.
+    std::vector<int> candidates;
+    for(size_t i = 0; i < std::min(max, max_positions); i++) candidates.push_back(i);
+    if(min != max) for(size_t i = 1; i <= std::min(max, max_positions); i++) candidates.push_back(-int(i));
+    const size_t size_candidate = candidates.size();
+
+    std::vector<bool> chosen(candidates.size()+1, false);
+    auto countDistinct = [&](){
+        std::vector<uint32_t> classes(keys.size(), 0);
+        size_t count = 1;
+        for(size_t i = 0; i < chosen.size(); i++)
+            if(chosen[i]) count = refineClasses(keys, i < size_candidate ? candidates[i] : 0, i == size_candidate, classes);
+        return count;
+    };
+
+    std::vector<uint32_t> classes(keys.size(), 0);
+    size_t distinct = 1;
+    while(distinct < keys.size()){
+        size_t best = chosen.size();
+        size_t best_distinct = distinct;
+        for(size_t i = 0; i < chosen.size(); i++){
+            if(chosen[i]) continue;
+            std::vector<uint32_t> refined = classes;
+            const size_t count = refineClasses(keys, i < size_candidate ? candidates[i] : 0, i == size_candidate, refined);
+            if(count > best_distinct){
+                best = i;
+                best_distinct = count;
+            }
+        }
+
+        if(best == chosen.size()) return KeyPositions();
+        chosen[best] = true;
+        distinct = refineClasses(keys, best < size_candidate ? candidates[best] : 0, best == size_candidate, classes);
+    }
+
+    for(size_t i = 0; i < chosen.size(); i++){
+        if(!chosen[i]) continue;
+        chosen[i] = false;
+        if(countDistinct() != keys.size()) chosen[i] = true;
+    }
+
+    KeyPositions result;
+    for(size_t i = 0; i < candidates.size(); i++)
+        if(chosen[i]) result.positions.push_back(candidates[i]);
+    result.use_size = chosen[size_candidate];
+    result.min_size = min;
+    assert(result.positions.size() < 256);
+
+    return result;
+}
+
+template<typename KeyType>
+KeyPositions selectKeyPositions(const std::vector<KeyType>&){
+    return KeyPositions();
+}
+
+//Returns the bytes of the key characters
+size_t writeKeys(std::string& str,
+                 const std::vector<std::string>& keys,
+                 const std::vector<int>& mapping,
+                 std::vector<SlotField>& fields,
+                 bool interleaved){
     size_t num_chars = 0;
     std::vector<size_t> sze;
     std::vector<size_t> start;
@@ -45,81 +399,34 @@ void writeKeys(std::string& str,
     for(const std::string& key : keys){
         for(uint8_t i = 0; i < 8; i++) str.push_back(' ');
         for(const char& ch : key){
-            str.push_back('\'');
-            str.push_back(ch);
-            str.push_back('\'');
+            str += literalStr(std::string(1, ch), '\'');
             str.push_back(',');
         }
         str.push_back('\n');
     }
     str += "    };\n\n";
 
-    str += "    static constexpr std::array<size_t, " + std::to_string(n+1) + "> key_start {\n        ";
-    size_t i = 0;
-    for(const int& val : mapping){
-        if(i && i%entries_per_row == 0) str += "\n        ";
-        i++;
-        if(val == -1) str += "0,";
-        else str += std::to_string(start[val]) + ",";
-    }
-    str += "\n    };\n\n";
-
-    str += "    static constexpr std::array<size_t, " + std::to_string(n+1) + "> key_size {\n        ";
-    i = 0;
+    std::vector<size_t> key_start;
+    std::vector<size_t> key_size;
     for(const int& val : mapping){
-        if(i && i%entries_per_row == 0) str += "\n        ";
-        i++;
-        if(val == -1) str += "0,";
-        else str += std::to_string(sze[val]) + ",";
+        key_start.push_back(val == -1 ? 0 : start[val]);
+        key_size.push_back(val == -1 ? 0 : sze[val]);
     }
-    str += "\n    };\n\n";
+    fields.push_back(makeField("key_start", key_start));
+    fields.push_back(makeField("key_size", key_size));
 
-    str += "    static inline bool checkBin(const std::string& key, size_t bin) noexcept{\n"
-           "        const auto& size = key_size[bin];\n"
+    str += "    static inline bool checkBin(std::string_view key, size_t bin) noexcept{\n"
+           "        const size_t size = " + slotRef("key_size", "bin", interleaved) + ";\n"
            "        if(size != key.size()) return false;\n"
-           "        const auto& start = key_start[bin];\n"
-           "        for(size_t i = size-1; i < std::numeric_limits<size_t>::max(); i--)\n"
-           "            if(key[i] != flat_keys[start+i]) return false;\n"
-           "        return true;\n"
-           "    }\n";
-}
-
-template<typename KeyType>
-void writeKeys(std::string& str,
-               const std::vector<KeyType>& keys,
-               std::string key_type,
-               const std::vector<int>& mapping,
-               size_t n){
-    str += "    static constexpr std::array<" + key_type + ", " + std::to_string(n+1) + "> keys {\n        ";
-
-    size_t i = 0;
-    for(const int& val : mapping){
-        if(i && i%entries_per_row==0) str += "\n        ";
-        i++;
-        if(val == -1) str += "0,";
-        else    str += std::to_string(keys[val]) + ",";
-    }
-    str += "\n    };\n";
-}
-
-void writeKeys(std::string& str, const std::vector<uint64_t>& keys, const std::vector<int>& mapping, size_t n){
-    writeKeys<uint64_t>(str, keys, "uint64_t", mapping, n);
-}
+           "        const size_t start = " + slotRef("key_start", "bin", interleaved) + ";\n"
+           "        return size == 0 || std::memcmp(key.data(), &flat_keys[start], size) == 0;\n"
+           "    }\n\n";
 
-void writeKeys(std::string& str, const std::vector<uint32_t>& keys, const std::vector<int>& mapping, size_t n){
-    writeKeys<uint32_t>(str, keys, "uint32_t", mapping, n);
-}
-
-void writeKeys(std::string& str, const std::vector<uint16_t>& keys, const std::vector<int>& mapping, size_t n){
-    writeKeys<uint16_t>(str, keys, "uint16_t", mapping, n);
-}
-
-void writeKeys(std::string& str, const std::vector<uint8_t>& keys, const std::vector<int>& mapping, size_t n){
-    writeKeys<uint8_t>(str, keys, "uint8_t", mapping, n);
+    return num_chars;
 }
 
 std::string typeStr(const std::string&){
-    return "std::string";
+    return "std::string_view";
 }
 
 std::string typeStr(uint64_t){
@@ -138,13 +445,191 @@ std::string typeStr(uint8_t){
     return "uint8_t";
 }
 
+//String keys are taken by view so lookups never allocate
+std::string keyParam(const std::string& key_type){
+    return key_type == "std::string_view" ? "std::string_view key" : "const " + key_type + "& key";
+}
+
+template<typename KeyType>
+size_t writeKeys(std::string&,
+                 const std::vector<KeyType>& keys,
+                 const std::vector<int>& mapping,
+                 std::vector<SlotField>& fields,
+                 bool){
+    SlotField field {"keys", typeStr(KeyType()), {}};
+    for(const int& val : mapping)
+        field.values.push_back(val == -1 ? "0" : std::to_string(keys[val]));
+    fields.push_back(field);
+
+    return 0;
+}
+
+//Emits lookup_batch(), which resolves a group of queries at a time in AMAC-style stages so the loads of one key
+//overlap with those of the rest of the group. hash_stages fills bins[] from queries[start+i], prefetching whatever
+//table each of its stages reads next. The slot records are then prefetched, then the key characters, and
+//only the last stage compares keys. A query whose slot holds another key scans the stash, if there is one.
+std::string lookupBatchStr(const std::string& map_name,
+                           const std::string& key_type,
+                           const std::string& hash_stages,
+                           const std::string& default_value,
+                           bool nonKeyLookups,
+                           const SearchOptions& options,
+                           bool stashed = false){
+    const bool string_keys = key_type == "std::string_view";
+    const bool interleaved = options.interleave_slots;
+
+    std::string str =
+        "inline void " + map_name + "::lookup_batch(const " + key_type + "* queries, size_t n, std::string_view* out) noexcept{\n"
+        "    constexpr size_t group = 16;\n"
+        "    size_t bins[group];\n"
+        "\n"
+        "    for(size_t start = 0; start < n; start += group){\n"
+        "        const size_t count = n - start < group ? n - start : group;\n"
+        "\n"
+        + hash_stages +
+        "\n";
+
+    //Every field array the last stage reads, or the one record holding them all
+    std::vector<std::string> fields;
+    if(nonKeyLookups) fields.push_back(string_keys ? "key_size" : "keys");
+    if(nonKeyLookups && string_keys) fields.push_back("key_start");
+    fields.push_back("val_start");
+    fields.push_back("val_size");
+    if(interleaved) fields.resize(1);
+
+    str += "        for(size_t i = 0; i < count; i++)" + std::string(fields.size() > 1 ? "{" : "") + "\n";
+    for(const std::string& field : fields)
+        str += "            POIFECT_PREFETCH(&" + slotRef(field, "bins[i]", interleaved) + ");\n";
+    if(fields.size() > 1) str += "        }\n";
+    str += "\n";
+
+    if(nonKeyLookups && string_keys) str +=
+        "        for(size_t i = 0; i < count; i++)\n"
+        "            POIFECT_PREFETCH(&flat_keys[" + slotRef("key_start", "bins[i]", interleaved) + "]);\n"
+        "\n";
+
+    str +=
+        "        for(size_t i = 0; i < count; i++){\n";
+    if(nonKeyLookups){
+        const std::string check = string_keys ? "checkBin(queries[start+i], bins[i])"
+                                              : slotRef("keys", "bins[i]", interleaved) + " == queries[start+i]";
+        str +=
+        "            out[start+i] = " + check + " ? " + valueStr("bins[i]", interleaved) + " : " + missStr("queries[start+i]", default_value, stashed) + ";\n";
+    }else{
+        const std::string check = string_keys ? "checkBin(queries[start+i], bins[i])" : "keys[bins[i]] == queries[start+i]";
+        str +=
+        "            #ifndef NDEBUG\n"
+        "            assert(" + check + ");\n"
+        "            #endif\n"
+        "            out[start+i] = " + valueStr("bins[i]", interleaved) + ";\n";
+    }
+    str +=
+        "        }\n"
+        "    }\n"
+        "}\n\n";
+
+    return str;
+}
+
+//Emits find_batch() for integer maps, which writes each query's slot, or -1 when the query isn't a key. With
+//AVX2 eight queries are hashed at once by simd_bins, which sets bins from the widened queries in x, and the
+//stored keys are gathered to test for hits. Scalar code finishes the tail, and covers builds without AVX2 and
+//64-bit keys, and is all that's emitted without simd_bins. The gathers read four bytes per key, so
+//getCommonCodeGen() pads narrower key arrays. Misses are looked for in the stash, if there is one.
+std::string findBatchStr(const std::string& map_name,
+                         const std::string& key_type,
+                         size_t key_bytes,
+                         const std::string& preamble,
+                         const std::string& simd_bins,
+                         const std::string& scalar_bin,
+                         bool nonKeyLookups,
+                         const SearchOptions& options,
+                         bool stashed = false){
+    const bool interleaved = options.interleave_slots && nonKeyLookups;
+
+    std::string str =
+        "inline void " + map_name + "::find_batch(const " + key_type + "* queries, size_t n, int32_t* found) noexcept{\n"
+        + preamble +
+        "    size_t i = 0;\n";
+
+    if(key_bytes <= 4 && !simd_bins.empty()){
+        std::string load;
+        if(key_bytes == 1) load = "_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(queries+i)))";
+        else if(key_bytes == 2) load = "_mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(queries+i)))";
+        else load = "_mm256_loadu_si256(reinterpret_cast<const __m256i*>(queries+i))";
+
+        str +=
+        "\n"
+        "    #ifdef __AVX2__\n"
+        "    for(const size_t simd_end = n - n%8; i < simd_end; i += 8){\n"
+        "        const __m256i x = " + load + ";\n"
+        + simd_bins;
+
+        if(nonKeyLookups){
+            std::string gather;
+            if(interleaved) gather =
+        "        const int* stored_keys = reinterpret_cast<const int*>(reinterpret_cast<const char*>(slots.data()) + offsetof(Slot, key));\n"
+        "        __m256i stored = _mm256_i32gather_epi32(stored_keys, _mm256_mullo_epi32(bins, _mm256_set1_epi32(sizeof(Slot))), 1);\n";
+            else gather =
+        "        __m256i stored = _mm256_i32gather_epi32(reinterpret_cast<const int*>(keys.data()), bins, " + std::to_string(key_bytes) + ");\n";
+            if(key_bytes < 4) gather +=
+        "        stored = _mm256_and_si256(stored, _mm256_set1_epi32(" + std::to_string((1u << 8*key_bytes) - 1) + "));\n";
+            str += gather +
+        "        const __m256i miss = _mm256_xor_si256(_mm256_cmpeq_epi32(stored, x), _mm256_set1_epi32(-1));\n"
+        "        bins = _mm256_or_si256(bins, miss);\n";
+        }
+
+        str +=
+        "        _mm256_storeu_si256(reinterpret_cast<__m256i*>(found+i), bins);\n";
+        if(nonKeyLookups && stashed) str +=
+        "        for(size_t j = i; j < i+8; j++)\n"
+        "            if(found[j] < 0) found[j] = findStash(queries[j]);\n";
+        str +=
+        "    }\n"
+        "    #endif\n";
+    }
+
+    str +=
+        "\n"
+        "    for(; i < n; i++){\n"
+        "        const " + key_type + "& key = queries[i];\n"
+        + scalar_bin;
+    if(nonKeyLookups) str +=
+        "        found[i] = " + slotRef("keys", "bin", interleaved) + " == key ? int32_t(bin) : " + (stashed ? "findStash(key)" : "-1") + ";\n";
+    else str +=
+        "        found[i] = int32_t(bin);\n";
+    str +=
+        "    }\n";
+
+    if(!nonKeyLookups) str +=
+        "\n"
+        "    #ifndef NDEBUG\n"
+        "    for(i = 0; i < n; i++) assert(keys[found[i]] == queries[i]);\n"
+        "    #endif\n";
+
+    str +=
+        "}\n\n";
+
+    return str;
+}
+
+//The value of a slot from find_batch(), or the default for -1
+std::string slotValueStr(const std::string& map_name, const std::string& default_value, const SearchOptions& options){
+    return "constexpr std::string_view " + map_name + "::value(int32_t slot) noexcept{\n"
+           "    return slot < 0 ? " + viewStr(default_value) + " : " + valueStr("slot", options.interleave_slots) + ";\n"
+           "}\n\n";
+}
+
 template<typename KeyType>
 std::string getCommonCodeGen(const std::vector<KeyType>& keys,
                              const std::vector<std::string> vals,
-                             const std::vector<int>& mapping,
+                             const std::vector<int>& slot_mapping,
                              size_t n,
                              std::string map_name,
-                             bool nonKeyLookups){
+                             const std::string& default_value,
+                             bool nonKeyLookups,
+                             const SearchOptions& options,
+                             size_t* table_bytes = nullptr){
     std::string upper_name = map_name;
     std::transform(upper_name.begin(), upper_name.end(), upper_name.begin(), toupper);
 
@@ -153,22 +638,67 @@ std::string getCommonCodeGen(const std::vector<KeyType>& keys,
                       "#define POIFECT_" + upper_name + "_H\n"
                       "#include <array>\n";
 
+    const bool string_keys = typeStr(keys[0]) == "std::string_view";
+
     if(!nonKeyLookups) str += "#include <cassert>\n";
+    if(!string_keys) str += "#include <cstddef>\n"
+                            "#include <cstdint>\n";
+    if(string_keys) str += "#include <cstring>\n";
 
     str += "#include <limits>\n"
-           "#include <string>\n\n";
+           "#include <string>\n"
+           "#include <string_view>\n\n";
+
+    str += "#ifndef POIFECT_PREFETCH\n"
+           "#if defined(__GNUC__)\n"
+           "#define POIFECT_PREFETCH(address) __builtin_prefetch(address)\n"
+           "#elif defined(_M_X64) || defined(_M_IX86)\n"
+           "#include <xmmintrin.h>\n"
+           "#define POIFECT_PREFETCH(address) _mm_prefetch(reinterpret_cast<const char*>(address), _MM_HINT_T0)\n"
+           "#else\n"
+           "#define POIFECT_PREFETCH(address)\n"
+           "#endif\n"
+           "#endif\n\n";
+
+    if(!string_keys) str += "#ifdef __AVX2__\n"
+                            "#include <immintrin.h>\n"
+                            "#endif\n\n";
 
     str += "class " + map_name + " final{\n"
     "public:\n"
-    "    static " + (typeStr(keys[0])!="std::string" ? "constexpr " : "")
-            + "std::string_view lookup(const " + typeStr(keys[0]) + "& key) noexcept;\n"
+    "    static " + (!string_keys ? "constexpr " : "")
+            + "std::string_view lookup(" + keyParam(typeStr(keys[0])) + ") noexcept;\n";
+    if(string_keys) str +=
+    "    static std::string_view lookup(const char* str, size_t size) noexcept{\n"
+    "        return lookup(std::string_view(str, size));\n"
+    "    }\n";
+    str +=
+    "    static void lookup_batch(const " + typeStr(keys[0]) + "* queries, size_t n, std::string_view* out) noexcept;\n";
+    if(!string_keys) str +=
+    "    static void find_batch(const " + typeStr(keys[0]) + "* queries, size_t n, int32_t* found) noexcept;\n"
+    "    static constexpr std::string_view value(int32_t slot) noexcept;\n";
+    str +=
     "\n"
     "private:\n";
 
+    //find_batch() gathers four bytes at each stored key, so narrower integer keys get empty trailing slots
+    std::vector<int> mapping(slot_mapping);
+    if(!string_keys && nonKeyLookups && sizeof(KeyType) < 4) mapping.resize(mapping.size() + 3/sizeof(KeyType), -1);
+
+    //Keys are only stored for release builds when lookups may miss, and only then share the slot records
+    const bool interleave_keys = options.interleave_slots && nonKeyLookups;
+    std::vector<SlotField> fields;
+
     if(!nonKeyLookups) str += "    #ifndef NDEBUG\n";
-    writeKeys(str, keys, mapping, n);
-    if(!nonKeyLookups) str += "    #endif\n";
-    str += "\n";
+    size_t bytes = writeKeys(str, keys, mapping, fields, interleave_keys);
+    if(!interleave_keys){
+        bytes += writeSlots(str, fields, false);
+        fields.clear();
+    }
+    if(!nonKeyLookups){
+        str += "    #endif\n\n";
+        bytes = 0;
+    }
 
     size_t num_chars = 0;
     std::vector<size_t> sze;
@@ -180,40 +710,62 @@ std::string getCommonCodeGen(const std::vector<KeyType>& keys,
         sze.push_back(val.size());
     }
 
-    str += "    static constexpr char flat_vals[" + std::to_string(num_chars+1) + "] = ";
+    str += "    static constexpr char flat_vals[" + std::to_string(num_chars + default_value.size() + 1) + "] = ";
     for(const std::string& val : vals){
         str.push_back('\n');
         for(uint8_t i = 0; i < 8; i++) str.push_back(' ');
-        str += '"' + val + '"';
+        str += literalStr(val);
     }
-    str += ";\n\n";
+    str += "\n        " + literalStr(default_value) + ";\n\n";
 
-    str += "    static constexpr std::array<size_t, " + std::to_string(n+1) + "> val_start {\n        ";
-    size_t i = 0;
+    //Empty slots hold the default value, so a key matching an empty slot's blank entry still misses
+    std::vector<size_t> val_start;
+    std::vector<size_t> val_size;
     for(const int& val : mapping){
-        if(i && i%entries_per_row == 0) str += "\n        ";
-        i++;
-        if(val == -1) str += "0,";
-        else str += std::to_string(start[val]) + ",";
+        val_start.push_back(val == -1 ? num_chars : start[val]);
+        val_size.push_back(val == -1 ? default_value.size() : sze[val]);
     }
-    str += "\n    };\n\n";
-
-    str += "    static constexpr std::array<size_t, " + std::to_string(n+1) + "> val_size {\n        ";
-    i = 0;
-    for(const int& val : mapping){
-        if(i && i%entries_per_row == 0) str += "\n        ";
-        i++;
-        if(val == -1) str += "0,";
-        else str += std::to_string(sze[val]) + ",";
+    fields.push_back(makeField("val_start", val_start));
+    fields.push_back(makeField("val_size", val_size));
+
+    bytes += num_chars + default_value.size() + 1;
+    bytes += writeSlots(str, fields, options.interleave_slots);
+    if(table_bytes) *table_bytes = bytes;
+
+    //Slots from n+1 on hold the stash, which lookups scan for a query whose own slot holds another key
+    const size_t stash_end = slot_mapping.size();
+    const size_t stash_start = n+1;
+    if(stash_end > stash_start){
+        assert(nonKeyLookups);
+        const std::string range = "size_t bin = " + std::to_string(stash_start) + "; bin < " + std::to_string(stash_end) + "; bin++";
+        const std::string check = string_keys ? "checkBin(key, bin)" : slotRef("keys", "bin", interleave_keys) + " == key";
+        const std::string specifier = string_keys ? "static inline " : "static inline constexpr ";
+
+        str += "    //" + std::to_string(stash_end - stash_start) + " keys the hash couldn't place\n";
+        if(!string_keys) str +=
+        "    " + specifier + "int32_t findStash(" + keyParam(typeStr(keys[0])) + ") noexcept{\n"
+        "        for(" + range + ")\n"
+        "            if(" + check + ") return int32_t(bin);\n"
+        "\n"
+        "        return -1;\n"
+        "    }\n"
+        "\n";
+        str +=
+        "    " + specifier + "std::string_view lookupStash(" + keyParam(typeStr(keys[0])) + ") noexcept{\n"
+        "        for(" + range + ")\n"
+        "            if(" + check + ") return " + valueStr("bin", options.interleave_slots) + ";\n"
+        "\n"
+        "        return " + viewStr(default_value) + ";\n"
+        "    }\n"
+        "\n";
     }
-    str += "\n    };\n\n";
 
     return str;
 }
 
 //This is a function I was playing around with to identify possible optimizations.
 //I love the idea of unwrapping the loop over the string, but it's not possible for every key set.
-//I'm leaving this as a note since I don't want highly specialized optimizations yet.
+//SearchOptions::key_positions now does that with selectKeyPositions() where the key set allows it.
 #include <iostream>
 #include <unordered_set>
 void analyze(const std::vector<std::string>& keys){
@@ -271,6 +823,13 @@ void analyze(const std::vector<std::string>& keys){
         set.insert(subkey);
     }
     if(set.size() == keys.size()) std::cout << "Last " << min << " chars are unique" << std::endl;
+
+    const KeyPositions selected = selectKeyPositions(keys);
+    if(!selected.active()) return;
+    std::cout << "Key positions:";
+    for(const int& pos : selected.positions) std::cout << ' ' << selected.str(pos);
+    if(selected.use_size) std::cout << " key.size()";
+    std::cout << std::endl;
 }
 
 #endif // HASHUTIL_H
@@ -2,271 +2,13 @@
 #include <fstream>
 
 #include "hashbenchmark.h"
+#include "hashconstexpr.h"
+#include "hashmapped.h"
+#include "hashruntime.h"
 #include "hashsearch.h"
 #include "hashsearch2.h"
-
-static std::vector<std::string> cpp_keywords {
-    "alignas", //(since C++11)
-    "alignof", //(since C++11)
-    "and",
-    "and_eq",
-    "asm",
-    "atomic_cancel", //(TM TS)
-    "atomic_commit", //(TM TS)
-    "atomic_noexcept", //(TM TS)
-    "auto",
-    "bitand",
-    "bitor",
-    "bool",
-    "break",
-    "case",
-    "catch",
-    "char",
-    "char8_t", //(since C++20)
-    "char16_t", //(since C++11)
-    "char32_t", //(since C++11)
-    "class",
-    "compl",
-    "concept", //(since C++20)
-    "const",
-    "consteval", //(since C++20)
-    "constexpr", //(since C++11)
-    "constinit", //(since C++20)
-    "const_cast",
-    "continue",
-    "co_await", //(since C++20)
-    "co_return", //(since C++20)
-    "co_yield", //(since C++20)
-    "decltype", //(since C++11)
-    "default",
-    "delete",
-    "do",
-    "double",
-    "dynamic_cast",
-    "else",
-    "enum",
-    "explicit",
-    "export",
-    "extern",
-    "false",
-    "float",
-    "for",
-    "friend",
-    "goto",
-    "if",
-    "inline",
-    "int",
-    "long",
-    "mutable",
-    "namespace",
-    "new",
-    "noexcept", //(since C++11)
-    "not",
-    "not_eq",
-    "nullptr", //(since C++11)
-    "operator",
-    "or",
-    "or_eq",
-    "private",
-    "protected",
-    "public",
-    "reflexpr", //(reflection TS)
-    "register",
-    "reinterpret_cast",
-    "requires", //(since C++20)
-    "return",
-    "short",
-    "signed",
-    "sizeof",
-    "static",
-    "static_assert", //(since C++11)
-    "static_cast",
-    "struct",
-    "switch",
-    "synchronized", //(TM TS)
-    "template",
-    "this",
-    "thread_local", //(since C++11)
-    "throw",
-    "true",
-    "try",
-    "typedef",
-    "typeid",
-    "typename",
-    "union",
-    "unsigned",
-    "using",
-    "virtual",
-    "void",
-    "volatile",
-    "wchar_t",
-    "while",
-    "xor",
-    "xor_eq",
-};
-
-static std::vector<std::string> makeKeywordVals(){
-    std::vector<std::string> vals;
-    for(std::string keyword : cpp_keywords){
-        std::transform(keyword.begin(), keyword.end(), keyword.begin(), toupper);
-        vals.push_back(keyword);
-    }
-
-    return vals;
-}
-static std::vector<std::string> cpp_vals = makeKeywordVals();
-
-static std::vector<std::string> greek_keywords {
-    "alpha",
-    "Alpha",
-    "beta",
-    "Beta",
-    "chi",
-    "Chi",
-    "delta",
-    "Delta",
-    "epsilon",
-    "Epsilon",
-    "eta",
-    "Eta",
-    "gamma",
-    "Gamma",
-    "iota",
-    "Iota",
-    "kappa",
-    "Kappa",
-    "lambda",
-    "Lambda",
-    "mu",
-    "Mu",
-    "nu",
-    "Nu",
-    "omega",
-    "Omega",
-    "omicron",
-    "Omicron",
-    "phi",
-    "Phi",
-    "pi",
-    "Pi",
-    "psi",
-    "Psi",
-    "rho",
-    "Rho",
-    "sigma",
-    "Sigma",
-    "tau",
-    "Tau",
-    "theta",
-    "Theta",
-    "upsilon",
-    "Upsilon",
-    "xi",
-    "Xi",
-    "zeta",
-    "Zeta",
-};
-
-static std::vector<std::string> greek_vals {
-    "α",
-    "Α",
-    "β",
-    "Β",
-    "χ",
-    "Χ",
-    "δ",
-    "Δ",
-    "ϵ",
-    "Ε",
-    "η",
-    "Η",
-    "γ",
-    "Γ",
-    "ι",
-    "Ι",
-    "κ",
-    "Κ",
-    "λ",
-    "Λ",
-    "μ",
-    "Μ",
-    "ν",
-    "Ν",
-    "ω",
-    "Ω",
-    "ο",
-    "Ο",
-    "ϕ",
-    "Φ",
-    "π",
-    "Π",
-    "ψ",
-    "Ψ",
-    "ρ",
-    "Ρ",
-    "σ",
-    "Σ",
-    "τ",
-    "Τ",
-    "θ",
-    "Θ",
-    "υ",
-    "Υ",
-    "ξ",
-    "Ξ",
-    "ζ",
-    "Ζ",
-};
-
-static constexpr uint16_t symbolsToInt(char a, char b){
-    return a + (b << 8);
-}
-
-std::vector<uint16_t> symbols = {
-    symbolsToInt('-', '>'),
-    symbolsToInt('<', '-'),
-    symbolsToInt('=', '>'),
-    symbolsToInt('<', '='),
-    symbolsToInt('=', '/'),
-    symbolsToInt('=', '_'),
-    symbolsToInt('>', '/'),
-    symbolsToInt('<', '/'),
-    symbolsToInt('/', '0'),
-    symbolsToInt('/', '\\'),
-    symbolsToInt('\\', '/'),
-    symbolsToInt('|', '-'),
-    symbolsToInt('|', '|'),
-    symbolsToInt('~', '~'),
-    symbolsToInt(':', '='),
-    symbolsToInt('+', '_'),
-    symbolsToInt(':', ':'),
-    symbolsToInt('-', ':'),
-    symbolsToInt('<', '<'),
-    symbolsToInt('>', '>'),
-};
-
-std::vector<std::string> symbol_vals = {
-    "→",
-    "←",
-    "⇒",
-    "⇐",
-    "≠",
-    "≡",
-    "≯",
-    "≮",
-    "∅",
-    "∧",
-    "∨",
-    "⊢",
-    "‖",
-    "≈",
-    "≔",
-    "±",
-    "∷",
-    "∹",
-    "≪",
-    "≫",
-};
+#include "hashtuner.h"
+#include "testmaps.h"
 
 void saveToFile(const std::string& str, const std::string& filename){
     std::ofstream out(SRC"/" +filename);
@@ -274,21 +16,124 @@ void saveToFile(const std::string& str, const std::string& filename){
     out << str;
 }
 
+void printStats(const std::string& map_name, const SearchStats& stats){
+    std::cout << map_name << ": " << stats.summary() << "\n" << std::endl;
+}
+
+//Keys and values the generators have to escape, with a byte outside UTF-8 and a null character
+static std::vector<std::string> escaped_keys {"a\"b", "c\\d", "e'f", "g\nh", "\xff", "π"};
+static std::vector<std::string> escaped_vals {"x\"y", "\\", "'", "line\nbreak", std::string("nul\0byte", 8), "\xfe"};
+static const std::string escaped_default = "\"none\"";
+
 //#define BOOTSTRAPPED
 #ifdef BOOTSTRAPPED
 #include "poifect_adhocsymbols.h"
 #include "poifect_adhocsymbols2.h"
+#include "poifect_adhocsymbols2partitioned.h"
+#include "poifect_adhocsymbols2stash.h"
 #include "poifect_cppkeywords.h"
 #include "poifect_cppkeywords2.h"
+#include "poifect_cppkeywordspacked.h"
+#include "poifect_cppkeywords2packed.h"
+#include "poifect_cppkeywords2minimal.h"
+#include "poifect_cppkeywordspositions.h"
+#include "poifect_cppkeywords2positions.h"
+#include "poifect_cppkeywords2partitioned.h"
+#include "poifect_cppkeywords2stash.h"
+#include "poifect_cppkeywords_switch.h"
+#include "poifect_escapedkeys2.h"
+#include "poifect_escapedkeys_switch.h"
 #include "poifect_greekletters.h"
 #include "poifect_greekletters2.h"
+#include "poifect_greekletters_switch.h"
+#include "poifect_adhocsymbols_switch.h"
+
+//The same tables as GreekLetters2, found by the compiler
+static constexpr auto greek_map = poifect::make_map(greek_letters);
+static_assert( greek_map.lookup("pi") == "π" );
+static_assert( greek_map.lookup("vhi") == "" );
+
+//33 letters on reduction 2 make 16.5 layer-1 bins, which hashSearch2() truncates to a table of 16
+template<size_t... I>
+constexpr std::array<std::pair<std::string_view, std::string_view>, sizeof...(I)> greekPrefix(std::index_sequence<I...>){
+    return {{greek_letters[I]...}};
+}
+static constexpr auto greek_prefix_map = poifect::make_map<2>(greekPrefix(std::make_index_sequence<33>()));
+static_assert( greek_prefix_map.seeds.size() == 16 );
+
+struct GreekLettersConstexpr{
+    static std::string_view lookup(std::string_view key) noexcept{
+        return greek_map.lookup(key);
+    }
+};
+
+static PoifectRuntimeMap<std::string> cpp_runtime;
+
+struct CppKeywordsRuntime{
+    static std::string_view lookup(std::string_view key) noexcept{
+        return cpp_runtime.lookup(key);
+    }
+};
 
 #define NDEBUG
 #include "poifect_adhocsymbols_keyonly.h"
 #include "poifect_adhocsymbols2_keyonly.h"
+#undef NDEBUG
+#include <cassert>
+
+template<class Map, typename KeyType>
+void checkBatch(const std::vector<KeyType>& queries){
+    std::vector<std::string_view> out(queries.size());
+    Map::lookup_batch(queries.data(), queries.size(), out.data());
+    for(size_t i = 0; i < queries.size(); i++)
+        assert(out[i] == Map::lookup(queries[i]));
+}
+
+template<class Map, typename KeyType>
+void checkFindBatch(const std::vector<KeyType>& queries){
+    std::vector<int32_t> found(queries.size());
+    Map::find_batch(queries.data(), queries.size(), found.data());
+    for(size_t i = 0; i < queries.size(); i++)
+        assert(Map::value(found[i]) == Map::lookup(queries[i]));
+}
+
+//A runtime map built with the parameters of a generated map agrees with it on every query
+template<class Map, typename KeyType, typename QueryType>
+void checkRuntimeMap(const std::vector<KeyType>& keys,
+                     const std::vector<std::string>& vals,
+                     const std::vector<QueryType>& queries,
+                     std::string default_value,
+                     uint8_t engine,
+                     uint8_t expansion,
+                     uint8_t reduction,
+                     const SearchOptions& options = SearchOptions()){
+    PoifectRuntimeMap<KeyType> map;
+    const bool built = map.build(keys, vals, default_value, engine, expansion, reduction, options);
+    assert(built);
+    for(const QueryType& query : queries)
+        assert(map.lookup(query) == Map::lookup(query));
+
+    //So does a map file written from it
+    const bool written = PoifectMappedMap<KeyType>::write(map, "poifect_check.map");
+    assert(written);
+    PoifectMappedMap<KeyType> mapped;
+    const bool opened = mapped.open("poifect_check.map");
+    assert(opened);
+    for(const QueryType& query : queries)
+        assert(mapped.lookup(query) == Map::lookup(query));
+    mapped.close();
+    std::remove("poifect_check.map");
+}
 
 void checkPreviouslyGeneratedResults(){
     //This tests the previously generated results
+    for(size_t i = 0; i < escaped_keys.size(); i++){
+        assert( EscapedKeys2::lookup(escaped_keys[i]) == escaped_vals[i] );
+        assert( EscapedKeysSwitch::lookup(escaped_keys[i]) == escaped_vals[i] );
+    }
+    assert( EscapedKeys2::lookup("a\"") == escaped_default );
+    assert( EscapedKeysSwitch::lookup("a\"") == escaped_default );
+
     assert( CppKeywords::lookup("operator") == "OPERATOR" );
     assert( CppKeywords::lookup("operatee") == "IDENTIFIER" );
     assert( CppKeywords2::lookup("operator") == "OPERATOR" );
@@ -298,27 +143,193 @@ void checkPreviouslyGeneratedResults(){
     assert( AdhocSymbols::lookup(symbolsToInt('@', '!')) == "" );
     assert( AdhocSymbols2::lookup(symbolsToInt('-', '>')) == "→" );
     assert( AdhocSymbols2::lookup(symbolsToInt('@', '!')) == "" );
+    assert( AdhocSymbols2Partitioned::lookup(symbolsToInt('@', '!')) == "" );
 
     assert( GreekLetters::lookup("pi") == "π" );
     assert( GreekLetters::lookup("vhi") == "" );
     assert( GreekLetters2::lookup("pi") == "π" );
     assert( GreekLetters2::lookup("vhi") == "" );
 
+    assert( CppKeywordsPacked::lookup("operatee") == "IDENTIFIER" );
+    assert( CppKeywords2Packed::lookup("operatee") == "IDENTIFIER" );
+    assert( CppKeywords2Minimal::lookup("operatee") == "IDENTIFIER" );
+    assert( CppKeywordsPositions::lookup("operatee") == "IDENTIFIER" );
+    assert( CppKeywords2Positions::lookup("operatee") == "IDENTIFIER" );
+    assert( CppKeywordsPositions::lookup("x") == "IDENTIFIER" );
+    assert( CppKeywords2Positions::lookup("x") == "IDENTIFIER" );
+    assert( CppKeywords2Partitioned::lookup("operatee") == "IDENTIFIER" );
+    assert( CppKeywords2Stash::lookup("operatee") == "IDENTIFIER" );
+    assert( CppKeywords2Stash::lookup("") == "IDENTIFIER" );
+    assert( CppKeywords::lookup("") == "IDENTIFIER" );
+    assert( CppKeywords::lookup("operator+=", 8) == "OPERATOR" );
+    assert( CppKeywords2::lookup("operator+=", 8) == "OPERATOR" );
+    assert( CppKeywords2::lookup(std::string_view("operator+=", 9)) == "IDENTIFIER" );
+    assert( CppKeywords2::lookup("") == "IDENTIFIER" );
+
     for(size_t i = 0; i < cpp_keywords.size(); i++){
         assert(CppKeywords::lookup(cpp_keywords[i]) == cpp_vals[i]);
         assert(CppKeywords2::lookup(cpp_keywords[i]) == cpp_vals[i]);
+        assert(CppKeywordsPacked::lookup(cpp_keywords[i]) == cpp_vals[i]);
+        assert(CppKeywords2Packed::lookup(cpp_keywords[i]) == cpp_vals[i]);
+        assert(CppKeywords2Minimal::lookup(cpp_keywords[i]) == cpp_vals[i]);
+        assert(CppKeywordsPositions::lookup(cpp_keywords[i]) == cpp_vals[i]);
+        assert(CppKeywords2Positions::lookup(cpp_keywords[i]) == cpp_vals[i]);
+        assert(CppKeywords2Partitioned::lookup(cpp_keywords[i]) == cpp_vals[i]);
+        assert(CppKeywords2Stash::lookup(cpp_keywords[i]) == cpp_vals[i]);
     }
 
+    //Stashed maps miss on keys that aren't theirs, also when a slot or the stash is probed
+    for(const std::string& letter : greek_keywords)
+        assert(CppKeywords2Stash::lookup(letter) == "IDENTIFIER");
+    assert( AdhocSymbols2Stash::lookup(symbolsToInt('@', '!')) == "" );
+
     for(size_t i = 0; i < greek_keywords.size(); i++){
         assert(GreekLetters::lookup(greek_keywords[i]) == greek_vals[i]);
         assert(GreekLetters2::lookup(greek_keywords[i]) == greek_vals[i]);
+        assert(greek_map.lookup(greek_keywords[i]) == greek_vals[i]);
     }
 
+    for(const std::string& keyword : cpp_keywords)
+        assert(greek_map.lookup(keyword) == GreekLetters2::lookup(keyword));
+
+    //make_map() finds the tables findHash2() does, also when the reduction doesn't divide the number of keys
+    const std::vector<std::string> greek_prefix(greek_keywords.begin(), greek_keywords.begin() + 33);
+    SearchResult2 prefix_result;
+    const bool prefix_found = findHash2(greek_prefix, 1, 2, SearchOptions(), prefix_result);
+    assert(prefix_found);
+    assert(prefix_result.s0 == greek_prefix_map.s0);
+    assert(prefix_result.n1.size() == greek_prefix_map.seeds.size() && prefix_result.n2.size() == greek_prefix_map.keys.size());
+    for(size_t h = 0; h < greek_prefix_map.seeds.size(); h++)
+        assert(prefix_result.layer1.bins[h].seed == greek_prefix_map.seeds[h]);
+    for(size_t slot = 0; slot < greek_prefix_map.keys.size(); slot++)
+        assert(greek_prefix_map.keys[slot] == (prefix_result.mapping[slot] == -1 ? "" : greek_prefix[prefix_result.mapping[slot]]));
+
+    //The switch baselines agree with the hash maps on keys and non-keys
+    for(const std::string& keyword : cpp_keywords){
+        assert(CppKeywordsSwitch::lookup(keyword) == CppKeywords2::lookup(keyword));
+        assert(GreekLettersSwitch::lookup(keyword) == GreekLetters2::lookup(keyword));
+    }
+    for(const std::string& letter : greek_keywords){
+        assert(CppKeywordsSwitch::lookup(letter) == CppKeywords2::lookup(letter));
+        assert(GreekLettersSwitch::lookup(letter) == GreekLetters2::lookup(letter));
+    }
+    assert( CppKeywordsSwitch::lookup("") == "IDENTIFIER" );
+    assert( AdhocSymbolsSwitch::lookup(symbolsToInt('@', '!')) == "" );
+
     for(size_t i = 0; i < symbols.size(); i++){
         assert(AdhocSymbols::lookup(symbols[i]) == symbol_vals[i]);
         assert(AdhocSymbols2::lookup(symbols[i]) == symbol_vals[i]);
+        assert(AdhocSymbols2Partitioned::lookup(symbols[i]) == symbol_vals[i]);
+        assert(AdhocSymbols2Stash::lookup(symbols[i]) == symbol_vals[i]);
+        assert(AdhocSymbolsSwitch::lookup(symbols[i]) == symbol_vals[i]);
     }
 
+    //Batches mix keys and non-keys and span several groups
+    std::vector<std::string_view> word_queries(cpp_keywords.begin(), cpp_keywords.end());
+    word_queries.insert(word_queries.end(), greek_keywords.begin(), greek_keywords.end());
+    checkBatch<CppKeywords>(word_queries);
+    checkBatch<CppKeywords2>(word_queries);
+    checkBatch<CppKeywordsPacked>(word_queries);
+    checkBatch<CppKeywords2Packed>(word_queries);
+    checkBatch<CppKeywords2Minimal>(word_queries);
+    checkBatch<CppKeywordsPositions>(word_queries);
+    checkBatch<CppKeywords2Positions>(word_queries);
+    checkBatch<CppKeywords2Partitioned>(word_queries);
+    checkBatch<CppKeywords2Stash>(word_queries);
+    checkBatch<GreekLetters>(word_queries);
+    checkBatch<GreekLetters2>(word_queries);
+
+    std::vector<uint16_t> symbol_queries(symbols);
+    symbol_queries.push_back(symbolsToInt('@', '!'));
+    checkBatch<AdhocSymbols>(symbol_queries);
+    checkBatch<AdhocSymbols2>(symbol_queries);
+    checkBatch<AdhocSymbols2Partitioned>(symbol_queries);
+    checkBatch<AdhocSymbols2Stash>(symbol_queries);
+    checkBatch<AdhocSymbolsKeyOnly>(symbols);
+    checkBatch<AdhocSymbols2KeyOnly>(symbols);
+    checkFindBatch<AdhocSymbols>(symbol_queries);
+    checkFindBatch<AdhocSymbols2>(symbol_queries);
+    checkFindBatch<AdhocSymbols2Partitioned>(symbol_queries);
+    checkFindBatch<AdhocSymbols2Stash>(symbol_queries);
+    checkFindBatch<AdhocSymbolsKeyOnly>(symbols);
+    checkFindBatch<AdhocSymbols2KeyOnly>(symbols);
+
+    SearchOptions minimal;
+    minimal.multiply_shift = true;
+    SearchOptions positions;
+    positions.key_positions = true;
+    SearchOptions partitioned;
+    partitioned.partition_size = 16;
+    SearchOptions minimal_partitioned = minimal;
+    minimal_partitioned.partition_size = 16;
+    checkRuntimeMap<CppKeywords>(cpp_keywords, cpp_vals, word_queries, "IDENTIFIER", 1, 3, 1);
+    checkRuntimeMap<CppKeywordsPositions>(cpp_keywords, cpp_vals, word_queries, "IDENTIFIER", 1, 3, 1, positions);
+    checkRuntimeMap<CppKeywords2>(cpp_keywords, cpp_vals, word_queries, "IDENTIFIER", 2, 1, 4);
+    checkRuntimeMap<CppKeywords2Minimal>(cpp_keywords, cpp_vals, word_queries, "IDENTIFIER", 2, 1, 4, minimal);
+    checkRuntimeMap<CppKeywords2Positions>(cpp_keywords, cpp_vals, word_queries, "IDENTIFIER", 2, 1, 4, positions);
+    checkRuntimeMap<GreekLetters>(greek_keywords, greek_vals, word_queries, "", 1, 2, 1);
+    checkRuntimeMap<GreekLetters2>(greek_keywords, greek_vals, word_queries, "", 2, 1, 1);
+    checkRuntimeMap<AdhocSymbols>(symbols, symbol_vals, symbol_queries, "", 1, 1, 1);
+    checkRuntimeMap<AdhocSymbols2>(symbols, symbol_vals, symbol_queries, "", 2, 1, 6);
+    checkRuntimeMap<CppKeywords2Partitioned>(cpp_keywords, cpp_vals, word_queries, "IDENTIFIER", 2, 1, 1, partitioned);
+    checkRuntimeMap<AdhocSymbols2Partitioned>(symbols, symbol_vals, symbol_queries, "", 2, 1, 1, minimal_partitioned);
+
+    //Neither engine finds a perfect hash for the keywords on these table sizes, but both place all but a few
+    SearchOptions stash;
+    stash.stash_size = 8;
+    checkRuntimeMap<CppKeywords>(cpp_keywords, cpp_vals, word_queries, "IDENTIFIER", 1, 2, 1, stash);
+    checkRuntimeMap<CppKeywords2>(cpp_keywords, cpp_vals, word_queries, "IDENTIFIER", 2, 1, 8, stash);
+    checkRuntimeMap<CppKeywords2Stash>(cpp_keywords, cpp_vals, word_queries, "IDENTIFIER", 2, 1, 8, stash);
+
+    PoifectRuntimeMap<std::string> words;
+    bool built = words.build(cpp_keywords, cpp_vals, "IDENTIFIER", 2, 1, 4);
+    assert(built);
+    bool written = PoifectMappedMap<std::string>::write(words, "poifect_check.map");
+    assert(written);
+    {
+        std::fstream file("poifect_check.map", std::ios::in | std::ios::out | std::ios::binary);
+        file.seekp(-1, std::ios::end);
+        file.put(1);
+    }
+    PoifectMappedMap<std::string> damaged;
+    assert(!damaged.open("poifect_check.map"));
+    assert(damaged.open("poifect_check.map", false));
+    damaged.close();
+    std::remove("poifect_check.map");
+
+    PoifectRuntimeMap<std::string> duplicates;
+    assert(!duplicates.build({"alpha", "beta", "alpha"}, {"1", "2", "3"}));
+    assert(duplicates.lookup("alpha") == "");
+
+    PoifectRuntimeMap<std::string> stashed;
+    assert(!stashed.build(cpp_keywords, cpp_vals, "IDENTIFIER", 2, 1, 8));
+    SearchStats stash_stats;
+    built = stashed.build(cpp_keywords, cpp_vals, "IDENTIFIER", 2, 1, 8, stash, &stash_stats);
+    assert(built && stash_stats.stashed_keys > 0 && stash_stats.stashed_keys <= stash.stash_size);
+    assert(stashed.size() == stash_stats.final_slots + stash_stats.stashed_keys);
+
+    //An updatable map built on a few keywords takes the rest one at a time, rebuilding when a bin can't be seeded
+    PoifectUpdatableMap<std::string> updatable;
+    built = updatable.build({cpp_keywords.begin(), cpp_keywords.begin()+8}, {cpp_vals.begin(), cpp_vals.begin()+8}, "IDENTIFIER");
+    assert(built);
+    for(size_t i = 8; i < cpp_keywords.size(); i++){
+        const bool inserted = updatable.insert(cpp_keywords[i], cpp_vals[i]);
+        assert(inserted);
+    }
+    assert(!updatable.insert("operator", "OPERATOR"));
+    for(const std::string_view& query : word_queries)
+        assert(updatable.lookup(query) == CppKeywords2::lookup(query));
+
+    PoifectUpdatableMap<uint16_t> updatable_symbols;
+    built = updatable_symbols.build({symbols.begin(), symbols.begin()+2}, {symbol_vals.begin(), symbol_vals.begin()+2}, "", 0.5, 2, 1, partitioned);
+    assert(built);
+    for(size_t i = 2; i < symbols.size(); i++){
+        const bool inserted = updatable_symbols.insert(symbols[i], symbol_vals[i]);
+        assert(inserted);
+    }
+    for(const uint16_t& query : symbol_queries)
+        assert(updatable_symbols.lookup(query) == AdhocSymbols2::lookup(query));
+
     std::cout << "TESTS SUCCESSFUL\n" << std::endl;
 
     std::cout << "CppKeyword keys: ";
@@ -331,6 +342,56 @@ void checkPreviouslyGeneratedResults(){
     std::cout << "CppKeyword2 non-keys: ";
     runBenchmark<CppKeywords2>(greek_keywords);
 
+    std::cout << "CppKeyword batch keys: ";
+    runBatchBenchmark<CppKeywords>(cpp_keywords);
+    std::cout << "CppKeyword2 batch keys: ";
+    runBatchBenchmark<CppKeywords2>(cpp_keywords);
+
+    std::cout << "CppKeywordPacked keys: ";
+    runBenchmark<CppKeywordsPacked>(cpp_keywords);
+    std::cout << "CppKeywordPacked non-keys: ";
+    runBenchmark<CppKeywordsPacked>(greek_keywords);
+
+    std::cout << "CppKeyword2Packed keys: ";
+    runBenchmark<CppKeywords2Packed>(cpp_keywords);
+    std::cout << "CppKeyword2Packed non-keys: ";
+    runBenchmark<CppKeywords2Packed>(greek_keywords);
+
+    std::cout << "CppKeyword2Minimal keys: ";
+    runBenchmark<CppKeywords2Minimal>(cpp_keywords);
+    std::cout << "CppKeyword2Minimal non-keys: ";
+    runBenchmark<CppKeywords2Minimal>(greek_keywords);
+
+    std::cout << "CppKeywordPositions keys: ";
+    runBenchmark<CppKeywordsPositions>(cpp_keywords);
+    std::cout << "CppKeywordPositions non-keys: ";
+    runBenchmark<CppKeywordsPositions>(greek_keywords);
+
+    std::cout << "CppKeyword2Positions keys: ";
+    runBenchmark<CppKeywords2Positions>(cpp_keywords);
+    std::cout << "CppKeyword2Positions non-keys: ";
+    runBenchmark<CppKeywords2Positions>(greek_keywords);
+
+    std::cout << "CppKeyword2Partitioned keys: ";
+    runBenchmark<CppKeywords2Partitioned>(cpp_keywords);
+    std::cout << "CppKeyword2Partitioned non-keys: ";
+    runBenchmark<CppKeywords2Partitioned>(greek_keywords);
+
+    const auto build_start = std::chrono::high_resolution_clock::now();
+    cpp_runtime.build(cpp_keywords, cpp_vals, "IDENTIFIER", 2, 1, 4);
+    const auto build_end = std::chrono::high_resolution_clock::now();
+    std::cout << "CppKeywordsRuntime build time: "
+              << std::chrono::duration_cast<std::chrono::microseconds>(build_end - build_start).count() << "us" << std::endl;
+    std::cout << "CppKeywordsRuntime keys: ";
+    runBenchmark<CppKeywordsRuntime>(cpp_keywords);
+    std::cout << "CppKeywordsRuntime non-keys: ";
+    runBenchmark<CppKeywordsRuntime>(greek_keywords);
+
+    std::cout << "CppKeywordsSwitch keys: ";
+    runBenchmark<CppKeywordsSwitch>(cpp_keywords);
+    std::cout << "CppKeywordsSwitch non-keys: ";
+    runBenchmark<CppKeywordsSwitch>(greek_keywords);
+
     std::cout << "GreekLetters keys: ";
     runBenchmark<GreekLetters>(greek_keywords);
     std::cout << "GreekLetters non-keys: ";
@@ -341,50 +402,202 @@ void checkPreviouslyGeneratedResults(){
     std::cout << "GreekLetters2 non-keys: ";
     runBenchmark<GreekLetters2>(cpp_keywords);
 
+    std::cout << "GreekLettersConstexpr keys: ";
+    runBenchmark<GreekLettersConstexpr>(greek_keywords);
+    std::cout << "GreekLettersConstexpr non-keys: ";
+    runBenchmark<GreekLettersConstexpr>(cpp_keywords);
+
     std::cout << "AdhocSymbol keys: ";
     runBenchmark<AdhocSymbols>(symbols);
     std::cout << "AdhocSymbol2 keys: ";
     runBenchmark<AdhocSymbols2>(symbols);
+    std::cout << "AdhocSymbol2Partitioned keys: ";
+    runBenchmark<AdhocSymbols2Partitioned>(symbols);
     std::cout << "AdhocSymbol keys only: ";
     runBenchmark<AdhocSymbolsKeyOnly>(symbols);
     std::cout << "AdhocSymbol2 keys only: ";
     runBenchmark<AdhocSymbols2KeyOnly>(symbols);
+    std::cout << "AdhocSymbolSwitch keys: ";
+    runBenchmark<AdhocSymbolsSwitch>(symbols);
 }
 #endif
 
+//A cost-ordered search places every key, picks the same coefficients on one thread as on many, and uses no
+//more nonzero coefficients than the lexicographic search
+template<typename KeyType>
+void checkCostOrdered(const std::vector<KeyType>& keys, uint8_t expansion, const SearchOptions& options){
+    SearchOptions cost_ordered = options;
+    cost_ordered.cost_ordered = true;
+    SearchOptions single_thread = cost_ordered;
+    single_thread.num_threads = 1;
+
+    SearchResult lexicographic, cheapest, cheapest_single;
+    [[maybe_unused]] bool found = findHash(keys, expansion, 1, options, lexicographic);
+    assert(found);
+    found = findHash(keys, expansion, 1, cost_ordered, cheapest);
+    assert(found && cheapest.stash.empty());
+    found = findHash(keys, expansion, 1, single_thread, cheapest_single);
+    assert(found && cheapest_single.c == cheapest.c);
+    assert(checkNonzeroCoeffs(cheapest.c) <= checkNonzeroCoeffs(lexicographic.c));
+
+    for(size_t i = 0; i < keys.size(); i++)
+        assert(cheapest.mapping[cheapest.n(hash(keys[i], cheapest.c, cheapest.positions))] == int(i));
+}
+
 int main(){
     std::string hash_str;
     bool success;
+    SearchStats stats;
+    SearchOptions options;
+    options.num_threads = 0;
+    SearchOptions compact = options;
+    compact.compact_seeds = true;
+    SearchOptions packed = compact;
+    packed.interleave_slots = true;
+    SearchOptions minimal = options;
+    minimal.multiply_shift = true;
+    SearchOptions positions = options;
+    positions.key_positions = true;
+    SearchOptions partitioned = options;
+    partitioned.partition_size = 16;
+    SearchOptions minimal_partitioned = minimal;
+    minimal_partitioned.partition_size = 16;
+    SearchOptions stash = options;
+    stash.stash_size = 8;
 
-    success = hashSearch2<std::string>(cpp_keywords, cpp_vals, hash_str, "CppKeywords2", "IDENTIFIER", 1, 4);
+    success = hashSearch2<std::string>(cpp_keywords, cpp_vals, hash_str, "CppKeywords2", "IDENTIFIER", 1, 4, true, compact, &stats);
     assert(success);
+    printStats("CppKeywords2", stats);
     saveToFile(hash_str, "poifect_cppkeywords2.h");
-    success = hashSearch2<std::string>(greek_keywords, greek_vals, hash_str, "GreekLetters2");
+    success = hashSearch2<std::string>(cpp_keywords, cpp_vals, hash_str, "CppKeywords2Packed", "IDENTIFIER", 1, 4, true, packed, &stats);
+    assert(success);
+    printStats("CppKeywords2Packed", stats);
+    saveToFile(hash_str, "poifect_cppkeywords2packed.h");
+    success = hashSearch2<std::string>(cpp_keywords, cpp_vals, hash_str, "CppKeywords2Minimal", "IDENTIFIER", 1, 4, true, minimal, &stats);
+    assert(success);
+    printStats("CppKeywords2Minimal", stats);
+    saveToFile(hash_str, "poifect_cppkeywords2minimal.h");
+    success = hashSearch2<std::string>(cpp_keywords, cpp_vals, hash_str, "CppKeywords2Positions", "IDENTIFIER", 1, 4, true, positions, &stats);
+    assert(success);
+    printStats("CppKeywords2Positions", stats);
+    saveToFile(hash_str, "poifect_cppkeywords2positions.h");
+    success = hashSearch2<std::string>(cpp_keywords, cpp_vals, hash_str, "CppKeywords2Partitioned", "IDENTIFIER", 1, 1, true, partitioned, &stats);
     assert(success);
+    printStats("CppKeywords2Partitioned", stats);
+    saveToFile(hash_str, "poifect_cppkeywords2partitioned.h");
+    success = hashSearch2<std::string>(cpp_keywords, cpp_vals, hash_str, "CppKeywords2Stash", "IDENTIFIER", 1, 8, true, stash, &stats);
+    assert(success && stats.stashed_keys > 0);
+    printStats("CppKeywords2Stash", stats);
+    saveToFile(hash_str, "poifect_cppkeywords2stash.h");
+
+    //A stash no trial fits in reports the size that would have done, on one table and on partitions
+    for(const SearchOptions& stashed : {stash, partitioned}){
+        SearchOptions small_stash = stashed;
+        small_stash.stash_size = 1;
+        success = hashSearch2<std::string>(cpp_keywords, cpp_vals, hash_str, "CppKeywords2Stash", "IDENTIFIER", 1, 8, true, small_stash, &stats);
+        assert(!success && stats.needed_stash > 1);
+        small_stash.stash_size = stats.needed_stash;
+        success = hashSearch2<std::string>(cpp_keywords, cpp_vals, hash_str, "CppKeywords2Stash", "IDENTIFIER", 1, 8, true, small_stash, &stats);
+        assert(success && stats.stashed_keys <= small_stash.stash_size && stats.needed_stash == 0);
+    }
+    success = hashSearch2<std::string>(greek_keywords, greek_vals, hash_str, "GreekLetters2", "", 1, 1, true, options, &stats);
+    assert(success);
+    printStats("GreekLetters2", stats);
     saveToFile(hash_str, "poifect_greekletters2.h");
-    success = hashSearch2<uint16_t>(symbols, symbol_vals, hash_str, "AdhocSymbols2", "", 1, 6);
+    success = hashSearch2<uint16_t>(symbols, symbol_vals, hash_str, "AdhocSymbols2", "", 1, 6, true, options, &stats);
     assert(success);
+    printStats("AdhocSymbols2", stats);
     saveToFile(hash_str, "poifect_adhocsymbols2.h");
-    success = hashSearch2<uint16_t>(symbols, symbol_vals, hash_str, "AdhocSymbols2KeyOnly", "", 1, 6, false);
+    success = hashSearch2<uint16_t>(symbols, symbol_vals, hash_str, "AdhocSymbols2Partitioned", "", 1, 1, true, minimal_partitioned, &stats);
+    assert(success);
+    printStats("AdhocSymbols2Partitioned", stats);
+    saveToFile(hash_str, "poifect_adhocsymbols2partitioned.h");
+    success = hashSearch2<uint16_t>(symbols, symbol_vals, hash_str, "AdhocSymbols2Stash", "", 1, 8, true, stash, &stats);
+    assert(success && stats.stashed_keys > 0);
+    printStats("AdhocSymbols2Stash", stats);
+    saveToFile(hash_str, "poifect_adhocsymbols2stash.h");
+    success = hashSearch2<std::string>(escaped_keys, escaped_vals, hash_str, "EscapedKeys2", escaped_default, 1, 1, true, options, &stats);
+    assert(success);
+    printStats("EscapedKeys2", stats);
+    saveToFile(hash_str, "poifect_escapedkeys2.h");
+    success = hashSearch2<uint16_t>(symbols, symbol_vals, hash_str, "AdhocSymbols2KeyOnly", "", 1, 6, false, compact, &stats);
     assert(success);
+    printStats("AdhocSymbols2KeyOnly", stats);
     saveToFile(hash_str, "poifect_adhocsymbols2_keyonly.h");
-    success = hashSearch<std::string>(cpp_keywords, cpp_vals, hash_str, "CppKeywords", "IDENTIFIER", 3);
+    success = hashSearch<std::string>(cpp_keywords, cpp_vals, hash_str, "CppKeywords", "IDENTIFIER", 3, 1, true, options, &stats);
     assert(success);
+    printStats("CppKeywords", stats);
     saveToFile(hash_str, "poifect_cppkeywords.h");
-    success = hashSearch<std::string>(greek_keywords, greek_vals, hash_str, "GreekLetters", "", 2);
+    success = hashSearch<std::string>(cpp_keywords, cpp_vals, hash_str, "CppKeywordsPacked", "IDENTIFIER", 3, 1, true, packed, &stats);
     assert(success);
+    printStats("CppKeywordsPacked", stats);
+    saveToFile(hash_str, "poifect_cppkeywordspacked.h");
+    success = hashSearch<std::string>(cpp_keywords, cpp_vals, hash_str, "CppKeywordsPositions", "IDENTIFIER", 3, 1, true, positions, &stats);
+    assert(success);
+    printStats("CppKeywordsPositions", stats);
+    saveToFile(hash_str, "poifect_cppkeywordspositions.h");
+    success = hashSearch<std::string>(greek_keywords, greek_vals, hash_str, "GreekLetters", "", 2, 1, true, options, &stats);
+    assert(success);
+    printStats("GreekLetters", stats);
     saveToFile(hash_str, "poifect_greekletters.h");
-    success = hashSearch<uint16_t>(symbols, symbol_vals, hash_str, "AdhocSymbols");
+    success = hashSearch<uint16_t>(symbols, symbol_vals, hash_str, "AdhocSymbols", "", 1, 1, true, options, &stats);
     assert(success);
+    printStats("AdhocSymbols", stats);
     saveToFile(hash_str, "poifect_adhocsymbols.h");
-    success = hashSearch<uint16_t>(symbols, symbol_vals, hash_str, "AdhocSymbolsKeyOnly", "", 1, 1, false);
+    success = hashSearch<uint16_t>(symbols, symbol_vals, hash_str, "AdhocSymbolsKeyOnly", "", 1, 1, false, options, &stats);
     assert(success);
+    printStats("AdhocSymbolsKeyOnly", stats);
     saveToFile(hash_str, "poifect_adhocsymbols_keyonly.h");
 
+    checkCostOrdered(cpp_keywords, 3, options);
+    checkCostOrdered(greek_keywords, 2, options);
+    checkCostOrdered(symbols, 1, options);
+
+    //An edit to the keys rebuilds the previous tables instead of searching again
+    std::vector<std::string> edited_keywords(cpp_keywords.begin()+3, cpp_keywords.end());
+    std::vector<std::string> edited_vals(cpp_vals.begin()+3, cpp_vals.end());
+    for(const char* word : {"assume", "contract_assert", "trivially_relocatable"}){
+        edited_keywords.push_back(word);
+        edited_vals.push_back("IDENTIFIER");
+    }
+    for(const SearchOptions& rebuilt : {options, partitioned}){
+        SearchResult2 tables;
+        success = hashRebuild2<std::string>({}, tables, cpp_keywords, cpp_vals, hash_str, "CppKeywords2Rebuilt", "IDENTIFIER", 1, 4, true, rebuilt);
+        assert(success);
+        success = hashRebuild2<std::string>(cpp_keywords, tables, edited_keywords, edited_vals, hash_str, "CppKeywords2Rebuilt", "IDENTIFIER", 1, 4, true, rebuilt, &stats);
+        assert(success && stats.rebuilt);
+        printStats("CppKeywords2Rebuilt", stats);
+    }
+
+    //Baselines for PoifectBenchmark
+    saveToFile(switchStr(cpp_keywords, cpp_vals, "CppKeywordsSwitch", "IDENTIFIER"), "poifect_cppkeywords_switch.h");
+    saveToFile(switchStr(greek_keywords, greek_vals, "GreekLettersSwitch", ""), "poifect_greekletters_switch.h");
+    saveToFile(switchStr(symbols, symbol_vals, "AdhocSymbolsSwitch", ""), "poifect_adhocsymbols_switch.h");
+    saveToFile(switchStr(escaped_keys, escaped_vals, "EscapedKeysSwitch", escaped_default), "poifect_escapedkeys_switch.h");
+
     #ifdef BOOTSTRAPPED
     checkPreviouslyGeneratedResults();
     #endif
 
+    //What CppKeywords would be generated with, timed on keywords and as many identifiers. A short sample keeps
+    //this quick in unoptimized builds; PoifectCli --tune times more.
+    std::vector<std::string_view> tuning_queries(cpp_keywords.begin(), cpp_keywords.end());
+    tuning_queries.insert(tuning_queries.end(), greek_keywords.begin(), greek_keywords.end());
+    tuning_queries.insert(tuning_queries.end(), greek_keywords.begin(), greek_keywords.end());
+    const std::vector<TunedConfig> configs = tuneMap(cpp_keywords, cpp_vals, tuning_queries, "IDENTIFIER", true, options, 20000, 1);
+    TunedConfig best;
+    success = bestConfig(configs, best);
+    assert(success);
+
+    //The configuration picked kept its tables, and generates the header a search with it would
+    std::string tuned_str;
+    success = writeTuned(cpp_keywords, cpp_vals, best, tuned_str, "CppKeywordsTuned", "IDENTIFIER", true);
+    assert(success);
+    success = best.engine == 1 ? hashSearch(cpp_keywords, cpp_vals, hash_str, "CppKeywordsTuned", "IDENTIFIER", best.expansion, best.reduction, true, best.options)
+                               : hashSearch2(cpp_keywords, cpp_vals, hash_str, "CppKeywordsTuned", "IDENTIFIER", best.expansion, best.reduction, true, best.options);
+    assert(success && tuned_str == hash_str);
+    std::cout << "Tuning CppKeywords:\n" << tuningTable(configs) << "best: " << best.args() << "\n" << std::endl;
+
     std::cout << "Analyzing greek keywords: ";
     analyze(greek_keywords);
 
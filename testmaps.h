@@ -0,0 +1,235 @@
+#ifndef TESTMAPS_H
+#define TESTMAPS_H
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+//The key sets of the test maps, shared by the HashSearch driver and the benchmark
+
+static std::vector<std::string> cpp_keywords {
+    "alignas", //(since C++11)
+    "alignof", //(since C++11)
+    "and",
+    "and_eq",
+    "asm",
+    "atomic_cancel", //(TM TS)
+    "atomic_commit", //(TM TS)
+    "atomic_noexcept", //(TM TS)
+    "auto",
+    "bitand",
+    "bitor",
+    "bool",
+    "break",
+    "case",
+    "catch",
+    "char",
+    "char8_t", //(since C++20)
+    "char16_t", //(since C++11)
+    "char32_t", //(since C++11)
+    "class",
+    "compl",
+    "concept", //(since C++20)
+    "const",
+    "consteval", //(since C++20)
+    "constexpr", //(since C++11)
+    "constinit", //(since C++20)
+    "const_cast",
+    "continue",
+    "co_await", //(since C++20)
+    "co_return", //(since C++20)
+    "co_yield", //(since C++20)
+    "decltype", //(since C++11)
+    "default",
+    "delete",
+    "do",
+    "double",
+    "dynamic_cast",
+    "else",
+    "enum",
+    "explicit",
+    "export",
+    "extern",
+    "false",
+    "float",
+    "for",
+    "friend",
+    "goto",
+    "if",
+    "inline",
+    "int",
+    "long",
+    "mutable",
+    "namespace",
+    "new",
+    "noexcept", //(since C++11)
+    "not",
+    "not_eq",
+    "nullptr", //(since C++11)
+    "operator",
+    "or",
+    "or_eq",
+    "private",
+    "protected",
+    "public",
+    "reflexpr", //(reflection TS)
+    "register",
+    "reinterpret_cast",
+    "requires", //(since C++20)
+    "return",
+    "short",
+    "signed",
+    "sizeof",
+    "static",
+    "static_assert", //(since C++11)
+    "static_cast",
+    "struct",
+    "switch",
+    "synchronized", //(TM TS)
+    "template",
+    "this",
+    "thread_local", //(since C++11)
+    "throw",
+    "true",
+    "try",
+    "typedef",
+    "typeid",
+    "typename",
+    "union",
+    "unsigned",
+    "using",
+    "virtual",
+    "void",
+    "volatile",
+    "wchar_t",
+    "while",
+    "xor",
+    "xor_eq",
+};
+
+static std::vector<std::string> makeKeywordVals(){
+    std::vector<std::string> vals;
+    for(std::string keyword : cpp_keywords){
+        std::transform(keyword.begin(), keyword.end(), keyword.begin(), toupper);
+        vals.push_back(keyword);
+    }
+
+    return vals;
+}
+static std::vector<std::string> cpp_vals = makeKeywordVals();
+
+static constexpr std::pair<std::string_view, std::string_view> greek_letters[] {
+    {"alpha", "α"},
+    {"Alpha", "Α"},
+    {"beta", "β"},
+    {"Beta", "Β"},
+    {"chi", "χ"},
+    {"Chi", "Χ"},
+    {"delta", "δ"},
+    {"Delta", "Δ"},
+    {"epsilon", "ϵ"},
+    {"Epsilon", "Ε"},
+    {"eta", "η"},
+    {"Eta", "Η"},
+    {"gamma", "γ"},
+    {"Gamma", "Γ"},
+    {"iota", "ι"},
+    {"Iota", "Ι"},
+    {"kappa", "κ"},
+    {"Kappa", "Κ"},
+    {"lambda", "λ"},
+    {"Lambda", "Λ"},
+    {"mu", "μ"},
+    {"Mu", "Μ"},
+    {"nu", "ν"},
+    {"Nu", "Ν"},
+    {"omega", "ω"},
+    {"Omega", "Ω"},
+    {"omicron", "ο"},
+    {"Omicron", "Ο"},
+    {"phi", "ϕ"},
+    {"Phi", "Φ"},
+    {"pi", "π"},
+    {"Pi", "Π"},
+    {"psi", "ψ"},
+    {"Psi", "Ψ"},
+    {"rho", "ρ"},
+    {"Rho", "Ρ"},
+    {"sigma", "σ"},
+    {"Sigma", "Σ"},
+    {"tau", "τ"},
+    {"Tau", "Τ"},
+    {"theta", "θ"},
+    {"Theta", "Θ"},
+    {"upsilon", "υ"},
+    {"Upsilon", "Υ"},
+    {"xi", "ξ"},
+    {"Xi", "Ξ"},
+    {"zeta", "ζ"},
+    {"Zeta", "Ζ"},
+};
+
+static std::vector<std::string> makeGreek(bool vals){
+    std::vector<std::string> strs;
+    for(const auto& letter : greek_letters)
+        strs.emplace_back(vals ? letter.second : letter.first);
+
+    return strs;
+}
+static std::vector<std::string> greek_keywords = makeGreek(false);
+static std::vector<std::string> greek_vals = makeGreek(true);
+
+static constexpr uint16_t symbolsToInt(char a, char b){
+    return a + (b << 8);
+}
+
+static std::vector<uint16_t> symbols = {
+    symbolsToInt('-', '>'),
+    symbolsToInt('<', '-'),
+    symbolsToInt('=', '>'),
+    symbolsToInt('<', '='),
+    symbolsToInt('=', '/'),
+    symbolsToInt('=', '_'),
+    symbolsToInt('>', '/'),
+    symbolsToInt('<', '/'),
+    symbolsToInt('/', '0'),
+    symbolsToInt('/', '\\'),
+    symbolsToInt('\\', '/'),
+    symbolsToInt('|', '-'),
+    symbolsToInt('|', '|'),
+    symbolsToInt('~', '~'),
+    symbolsToInt(':', '='),
+    symbolsToInt('+', '_'),
+    symbolsToInt(':', ':'),
+    symbolsToInt('-', ':'),
+    symbolsToInt('<', '<'),
+    symbolsToInt('>', '>'),
+};
+
+static std::vector<std::string> symbol_vals = {
+    "→",
+    "←",
+    "⇒",
+    "⇐",
+    "≠",
+    "≡",
+    "≯",
+    "≮",
+    "∅",
+    "∧",
+    "∨",
+    "⊢",
+    "‖",
+    "≈",
+    "≔",
+    "±",
+    "∷",
+    "∹",
+    "≪",
+    "≫",
+};
+
+#endif // TESTMAPS_H